@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "fastcopy.h"
+
+#define COPY_CHUNK (1L << 30)   // Per call; the kernel caps it lower anyway
+#define BUFFER_SIZE (1024 * 1024)
+#define BUFFER_ALIGN 4096
+
+// Each kernel-side method returns 1 if it copied everything, 0 if it is
+// not supported for this pair of descriptors and nothing was copied, and
+// -1 on a real error.
+
+static int copy_with_copy_file_range(int in_fd, int out_fd) {
+    int copied_any = 0;
+    while (1) {
+        ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK, 0);
+        if (n == 0) {
+            return 1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EXDEV, EINVAL, EOPNOTSUPP, ENOSYS...: try the next method
+            return copied_any ? -1 : 0;
+        }
+        copied_any = 1;
+    }
+}
+
+// splice needs a pipe on one side; the pages move without a user copy
+static int copy_with_splice(int in_fd, int out_fd) {
+    int copied_any = 0;
+    while (1) {
+        ssize_t n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == 0) {
+            return 1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return copied_any ? -1 : 0;
+        }
+        copied_any = 1;
+    }
+}
+
+static int copy_with_sendfile(int in_fd, int out_fd) {
+    int copied_any = 0;
+    while (1) {
+        ssize_t n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK);
+        if (n == 0) {
+            return 1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return copied_any ? -1 : 0;
+        }
+        copied_any = 1;
+    }
+}
+
+// The last resort, with one large page-aligned buffer kept for the process
+static int copy_with_read_write(int in_fd, int out_fd) {
+    static char *buffer = NULL;
+    if (buffer == NULL) {
+        void *p;
+        if (posix_memalign(&p, BUFFER_ALIGN, BUFFER_SIZE) != 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+        buffer = p;
+    }
+    while (1) {
+        ssize_t n = read(in_fd, buffer, BUFFER_SIZE);
+        if (n == 0) {
+            return 0;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = write(out_fd, buffer + done, n - done);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            done += w;
+        }
+    }
+}
+
+int fast_copy(int in_fd, int out_fd) {
+    struct stat in_st, out_st;
+    if (fstat(in_fd, &in_st) == -1 || fstat(out_fd, &out_st) == -1) {
+        return -1;
+    }
+
+    if (S_ISREG(in_st.st_mode)) {
+        posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    int result = 0;
+    if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode)) {
+        result = copy_with_copy_file_range(in_fd, out_fd);
+    }
+    if (result == 0 && (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode))) {
+        result = copy_with_splice(in_fd, out_fd);
+    }
+    if (result == 0 && S_ISREG(in_st.st_mode)) {
+        result = copy_with_sendfile(in_fd, out_fd);
+    }
+    if (result == 0) {
+        return copy_with_read_write(in_fd, out_fd);
+    }
+    return result == 1 ? 0 : -1;
+}
@@ -0,0 +1,11 @@
+#ifndef _FASTCOPY_H
+#define _FASTCOPY_H
+
+// Copies everything from in_fd's current offset to EOF into out_fd,
+// keeping the data in the kernel where it can: copy_file_range between
+// regular files, splice when either side is a pipe, sendfile from a regular
+// file to anything else, and read/write through a large page-aligned buffer
+// otherwise. Returns 0, or -1 with errno set.
+int fast_copy(int in_fd, int out_fd);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,24 +8,109 @@
 #include <fcntl.h>
 #include <stdbool.h>
 #include <sys/sysinfo.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include "umem.h"
 
+// A unit of work: either map a whole file, or compress one of its segments
 typedef struct {
-    char *data;
+    int file;
+    bool map;
+    size_t seq;   // Position of the segment in the concatenated stream; a
+                  // map task carries its file's first segment
     size_t start;
     size_t end;
 } FileSegment;
 
+// Work queue, kept as a binary min-heap in sequence order, so the segment
+// the sequencer needs next (or the map task producing it) is never stuck
+// behind later ones
 typedef struct {
     FileSegment *segments; // Dynamic array of FileSegments
-    int front, rear, size;
+    int size;
     int capacity;
     pthread_mutex_t mutex;
     pthread_cond_t cond_var;
 } SharedQueue;
 
+// One input file; all files together form a single logical stream
 typedef struct {
-    SharedQueue *queue;
-    char *data;
+    const char *path;
+    size_t size;
+    char *data;          // Mapped by whichever worker takes the file's map task
+    size_t first_seq;    // Sequence number of the file's first segment
+    size_t num_segments;
+    size_t remaining;    // Segments not yet compressed; the last one unmaps
+} InputFile;
+
+typedef struct {
+    size_t count;
+    char c;
+} Run;
+
+// Compressed output of one segment. The first and last runs are kept
+// unencoded so the sequencer can join runs across segment and file
+// boundaries; everything in between is already encoded in body.
+typedef struct {
+    bool ready;
+    size_t num_runs; // 0 when the file could not be mapped
+    Run first;
+    Run last;
+    char *body;
+    size_t body_len;
+    int owner;       // Worker arena the body came from, -1 for malloc
+} SegmentResult;
+
+// Output buffer back-end, chosen with --alloc
+typedef enum {
+    ALLOC_MALLOC,
+    ALLOC_UMEM
+} AllocBackend;
+
+#define ARENA_SEGMENTS 8 // In-flight segments a worker arena is sized for
+#define OUTPUT_WINDOW_PER_THREAD 4 // Segments a worker may run ahead of the sequencer
+
+// A worker's private umem heap. Only the owning worker allocates from or
+// frees into the heap; the sequencer hands written buffers back through
+// the returned list, which the owner drains in bulk.
+typedef struct {
+    UHeap *heap;
+    pthread_mutex_t lock;
+    void *returned;     // Linked through the first word of each buffer
+    size_t outstanding; // Buffers handed out and not yet drained back
+} WorkerArena;
+
+// Per-worker counters, only collected when --stats is given
+typedef struct {
+    size_t segments;
+    size_t bytes_in;
+    size_t bytes_out;
+    double compress_seconds;    // Mapping and compression, excluding output waits
+    double queue_wait_seconds;  // Blocked on the queue mutex/condvar
+    double output_wait_seconds; // Blocked handing results to the sequencer
+    long minor_faults;
+    long major_faults;
+    size_t arena_fallbacks;     // Output buffers that did not fit the arena
+} WorkerStats;
+
+// One sample of the queue depth, taken whenever a worker dequeues
+typedef struct {
+    double time;
+    int depth;
+} DepthSample;
+
+typedef struct {
+    SharedQueue *queue;   // Home queue: segments local to this worker's node
+    SharedQueue *queues;  // All per-node queues, for stealing
+    int num_queues;
+    int home;
+    int index;
+    WorkerStats *stats; // NULL unless --stats was given
     size_t start;
     size_t end;
     size_t file_size;
@@ -33,65 +119,546 @@ typedef struct {
 } ThreadArg;
 
 volatile int exit_condition = 0;
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; // Initialize the lock statically
+
+InputFile *files = NULL;
+size_t segment_size = 1024 * 1024; // 1MB per segment
+size_t pending_maps = 0;           // Map tasks not yet finished
+volatile int input_error = 0;      // A file could not be opened or mapped
+
+// Results are filled in by workers in any order and written by the
+// sequencer (the main thread) strictly in sequence order
+SegmentResult *results = NULL;
+size_t next_to_write = 0;
+size_t output_window = 0; // Segments from next_to_write that may be compressed
+double sequencer_wait_seconds = 0;
+pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t results_cond = PTHREAD_COND_INITIALIZER;
+
+AllocBackend alloc_backend = ALLOC_MALLOC;
+WorkerArena *arenas = NULL;
+
+// Worker placement policy for --affinity
+typedef enum {
+    PIN_NONE,
+    PIN_COMPACT, // Fill one node's CPUs before moving to the next
+    PIN_SCATTER  // Round-robin workers across nodes
+} PinPolicy;
+
+#define MAX_NODES 64
+
+int cpu_node[CPU_SETSIZE]; // NUMA node of each CPU, 0 when unknown
+int num_nodes = 1;
+int node_queue[MAX_NODES]; // Queue index serving each node, -1 if none
+
+// Queue depth samples, appended under depth_lock when --stats is on
+pthread_mutex_t depth_lock = PTHREAD_MUTEX_INITIALIZER;
+DepthSample *depth_samples = NULL;
+size_t depth_sample_count = 0;
+size_t depth_sample_capacity = 0;
+double stats_start_time = 0;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void record_depth(int depth) {
+    pthread_mutex_lock(&depth_lock);
+    if (depth_sample_count == depth_sample_capacity) {
+        size_t capacity = depth_sample_capacity ? depth_sample_capacity * 2 : 1024;
+        DepthSample *samples = realloc(depth_samples, sizeof(DepthSample) * capacity);
+        if (samples == NULL) {
+            // Drop the sample rather than fail the compression
+            pthread_mutex_unlock(&depth_lock);
+            return;
+        }
+        depth_samples = samples;
+        depth_sample_capacity = capacity;
+    }
+    depth_samples[depth_sample_count].time = now_seconds() - stats_start_time;
+    depth_samples[depth_sample_count].depth = depth;
+    depth_sample_count++;
+    pthread_mutex_unlock(&depth_lock);
+}
+
+// Parses a Linux-style CPU list such as "0-3,8,10-11"
+static int parse_cpu_list(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0)
+            return -1;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return -1;
+        }
+        if (last >= CPU_SETSIZE)
+            return -1;
+        for (long cpu = first; cpu <= last; ++cpu)
+            CPU_SET(cpu, set);
+        p = end;
+        if (*p == ',')
+            p++;
+        else if (*p != '\0' && *p != '\n')
+            return -1;
+    }
+    return 0;
+}
+
+// Fills cpu_node from sysfs; leaves a single node 0 if there is no NUMA info
+static void load_numa_topology(void) {
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir == NULL)
+        return;
+
+    int max_node = -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int node;
+        char extra;
+        if (sscanf(entry->d_name, "node%d%c", &node, &extra) != 1 || node < 0 || node >= MAX_NODES)
+            continue;
+
+        char path[300], list[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        cpu_set_t cpus;
+        if (fgets(list, sizeof(list), fp) != NULL && parse_cpu_list(list, &cpus) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &cpus))
+                    cpu_node[cpu] = node;
+            }
+            if (node > max_node)
+                max_node = node;
+        }
+        fclose(fp);
+    }
+    closedir(dir);
+
+    if (max_node >= 0)
+        num_nodes = max_node + 1;
+}
+
+// Chooses a CPU for every worker from the allowed set; returns -1 if empty
+static int plan_worker_cpus(PinPolicy policy, const cpu_set_t *allowed,
+                            int num_threads, int *worker_cpu) {
+    int order[CPU_SETSIZE];
+    int count = 0;
+
+    if (policy == PIN_COMPACT) {
+        for (int node = 0; node < num_nodes; ++node) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, allowed) && cpu_node[cpu] == node)
+                    order[count++] = cpu;
+            }
+        }
+    } else {
+        // Take the next unused CPU of each node in turn
+        int next[MAX_NODES] = {0};
+        bool progress = true;
+        while (progress) {
+            progress = false;
+            for (int node = 0; node < num_nodes; ++node) {
+                int cpu = next[node];
+                while (cpu < CPU_SETSIZE && !(CPU_ISSET(cpu, allowed) && cpu_node[cpu] == node))
+                    cpu++;
+                if (cpu < CPU_SETSIZE) {
+                    order[count++] = cpu;
+                    progress = true;
+                }
+                next[node] = cpu + 1;
+            }
+        }
+    }
+
+    if (count == 0)
+        return -1;
+    for (int j = 0; j < num_threads; ++j)
+        worker_cpu[j] = order[j % count];
+    return 0;
+}
+
+// Picks the queue for a segment: the node holding its page cache if the
+// first page is resident, otherwise a contiguous share of the file
+static int segment_queue(char *data, size_t start, size_t index, size_t num_segments,
+                         int num_queues, const unsigned char *resident) {
+    if (num_queues == 1)
+        return 0;
+
+    size_t page_size = getpagesize();
+    if (resident != NULL && (resident[start / page_size] & 1)) {
+        // Touching a resident page only maps it; move_pages then reports its node
+        void *page = data + (start & ~(page_size - 1));
+        int status = -1;
+        (void) *(volatile char *) page;
+        if (syscall(SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) == 0 &&
+            status >= 0 && status < MAX_NODES && node_queue[status] >= 0) {
+            return node_queue[status];
+        }
+    }
+    return (int) (index * num_queues / num_segments);
+}
 
 // Function prototypes
 int queue_is_empty(SharedQueue *q);
+void enqueue(SharedQueue *q, FileSegment item);
 FileSegment dequeue(SharedQueue *q);
+static void drain_arena(WorkerArena *arena);
 
-// Thread function 
-void *compressPart(void *arg) {
-    ThreadArg *threadArg = (ThreadArg *) arg;
-    SharedQueue *queue = threadArg->queue;
-    char *base_data = threadArg->data;  
+// Whether the worker may start a task now. Segments more than output_window
+// ahead of the sequencer wait, which bounds the compressed output held in
+// memory when stdout is slower than the workers. Map tasks are held back the
+// same way by their file's first segment, so only the files near the
+// sequencer are mapped at once. With --alloc=umem a worker also waits until
+// its arena has a free slot, except for the segment the sequencer needs
+// next, so the arena only falls back to malloc in that case.
+static bool can_start(ThreadArg *threadArg, FileSegment *segment) {
+    size_t next = __atomic_load_n(&next_to_write, __ATOMIC_ACQUIRE);
+    if (segment->seq == next)
+        return true;
+    if (segment->seq >= next + output_window)
+        return false;
+    if (segment->map)
+        return true;
+    if (alloc_backend == ALLOC_UMEM) {
+        WorkerArena *arena = &arenas[threadArg->index];
+        drain_arena(arena);
+        return arena->outstanding < ARENA_SEGMENTS;
+    }
+    return true;
+}
 
-    //printf("Thread starting, base_data: %p\n", (void *)base_data); // Debug Line
+// Takes the next segment, preferring the worker's home queue and stealing
+// from the other nodes' queues once the producer has finished. Time spent
+// held back by the output window counts as output wait.
+static bool next_segment(ThreadArg *threadArg, FileSegment *segment) {
+    SharedQueue *queue = threadArg->queue;
+    WorkerStats *stats = threadArg->stats;
 
+    pthread_mutex_lock(&queue->mutex);
     while (true) {
-        pthread_mutex_lock(&queue->mutex);
+        if (!queue_is_empty(queue) && can_start(threadArg, &queue->segments[0])) {
+            *segment = dequeue(queue);
+            if (stats)
+                record_depth(queue->size);
+            pthread_mutex_unlock(&queue->mutex);
+            return true;
+        }
+        if (queue_is_empty(queue) && exit_condition)
+            break;
+
+        // Either nothing is queued yet, or the sequencer has to catch up and
+        // hand buffers back; it broadcasts every time it moves on
+        bool throttled = !queue_is_empty(queue);
+        double before = (stats && throttled) ? now_seconds() : 0;
+        pthread_cond_wait(&queue->cond_var, &queue->mutex);
+        if (stats && throttled)
+            stats->output_wait_seconds += now_seconds() - before;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    for (int k = 1; k < threadArg->num_queues; ++k) {
+        SharedQueue *other = &threadArg->queues[(threadArg->home + k) % threadArg->num_queues];
+        pthread_mutex_lock(&other->mutex);
+        if (!queue_is_empty(other) && can_start(threadArg, &other->segments[0])) {
+            *segment = dequeue(other);
+            if (threadArg->stats)
+                record_depth(other->size);
+            pthread_mutex_unlock(&other->mutex);
+            return true;
+        }
+        pthread_mutex_unlock(&other->mutex);
+    }
+    return false;
+}
+
+// Formats one run as "<count><char>\n"; returns the number of bytes written
+static size_t encode_run(char *out, Run run) {
+    char digits[24];
+    size_t n = 0, len = 0;
+    do {
+        digits[n++] = '0' + run.count % 10;
+        run.count /= 10;
+    } while (run.count > 0);
+    while (n > 0)
+        out[len++] = digits[--n];
+    out[len++] = run.c;
+    out[len++] = '\n';
+    return len;
+}
+
+static void publish_result(size_t seq, SegmentResult *result, WorkerStats *stats) {
+    double before = 0;
+    if (stats)
+        before = now_seconds();
+    pthread_mutex_lock(&results_lock);
+    if (stats)
+        stats->output_wait_seconds += now_seconds() - before;
+    results[seq] = *result;
+    results[seq].ready = true;
+    if (seq == next_to_write)
+        pthread_cond_signal(&results_cond);
+    pthread_mutex_unlock(&results_lock);
+}
+
+// Takes back every buffer the sequencer has written since the last drain.
+// When all of them are back the heap is reset instead of freed piecemeal.
+static void drain_arena(WorkerArena *arena) {
+    pthread_mutex_lock(&arena->lock);
+    void *list = arena->returned;
+    arena->returned = NULL;
+    pthread_mutex_unlock(&arena->lock);
+
+    size_t count = 0;
+    for (void *p = list; p != NULL; p = *(void **) p)
+        count++;
+    if (count == 0)
+        return;
+
+    if (count == arena->outstanding) {
+        uheap_reset(arena->heap);
+    } else {
+        while (list != NULL) {
+            void *next = *(void **) list;
+            uheap_free(arena->heap, list);
+            list = next;
+        }
+    }
+    arena->outstanding -= count;
+}
+
+static char *alloc_body(ThreadArg *threadArg, size_t size, int *owner) {
+    if (size < sizeof(void *))
+        size = sizeof(void *); // Room for the returned-list link
+
+    if (alloc_backend == ALLOC_UMEM) {
+        WorkerArena *arena = &arenas[threadArg->index];
+        drain_arena(arena);
+        char *body = uheap_malloc(arena->heap, size);
+        if (body != NULL) {
+            arena->outstanding++;
+            *owner = threadArg->index;
+            return body;
+        }
+        // Only the segment the sequencer is waiting for gets here with a
+        // full arena; it must not wait, so it uses the system heap
+        if (threadArg->stats)
+            threadArg->stats->arena_fallbacks++;
+    }
+
+    *owner = -1;
+    return malloc(size);
+}
+
+// Called by the sequencer once a body has been written
+static void release_body(char *body, int owner) {
+    if (owner < 0) {
+        free(body);
+        return;
+    }
+    WorkerArena *arena = &arenas[owner];
+    pthread_mutex_lock(&arena->lock);
+    *(void **) body = arena->returned;
+    arena->returned = body;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+static void compress_segment(ThreadArg *threadArg, FileSegment segment) {
+    WorkerStats *stats = threadArg->stats;
+    InputFile *file = &files[segment.file];
+    char *segment_data = file->data + segment.start;
+    size_t segment_length = segment.end - segment.start;
+    SegmentResult result = {0};
+    double start = 0;
+    if (stats)
+        start = now_seconds();
+
+    // A run costs at most three output bytes per input byte. Arena bodies
+    // are all sized for a full segment, so ARENA_SEGMENTS of them always fit
+    // whatever order they come back in.
+    size_t body_size = (alloc_backend == ALLOC_UMEM ? segment_size : segment_length) * 3;
+    result.body = alloc_body(threadArg, body_size, &result.owner);
+    if (result.body == NULL) {
+        perror("Error allocating output buffer");
+        exit(EXIT_FAILURE);
+    }
+
+    Run prev = {0};
+    for (size_t i = 0; i < segment_length;) {
+        char current_char = segment_data[i];
+        size_t count = 0;
+
+        while (i < segment_length && segment_data[i] == current_char) {
+            count++;
+            i++;
+        }
+
+        // Runs strictly between the first and the last go straight to the body
+        if (result.num_runs == 0)
+            result.first = (Run){count, current_char};
+        else if (result.num_runs >= 2)
+            result.body_len += encode_run(result.body + result.body_len, prev);
+        prev = (Run){count, current_char};
+        result.num_runs++;
+    }
+    result.last = prev;
+
+    if (__atomic_sub_fetch(&file->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+        munmap(file->data, file->size);
+
+    if (stats) {
+        char scratch[48];
+        stats->segments++;
+        stats->bytes_in += segment_length;
+        stats->bytes_out += result.body_len + encode_run(scratch, result.first);
+        if (result.num_runs > 1)
+            stats->bytes_out += encode_run(scratch, result.last);
+        stats->compress_seconds += now_seconds() - start;
+    }
+
+    publish_result(segment.seq, &result, stats);
+}
+
+static void finish_map_task(ThreadArg *threadArg) {
+    if (__atomic_sub_fetch(&pending_maps, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    // Every segment is queued now, so idle workers may steal and then exit
+    exit_condition = 1;
+    for (int q = 0; q < threadArg->num_queues; ++q) {
+        pthread_mutex_lock(&threadArg->queues[q].mutex);
+        pthread_cond_broadcast(&threadArg->queues[q].cond_var);
+        pthread_mutex_unlock(&threadArg->queues[q].mutex);
+    }
+}
+
+// Maps a file and queues its segments; a single-segment file is compressed
+// right away, which keeps directories of tiny files off the queues
+static void map_file(ThreadArg *threadArg, int index) {
+    InputFile *file = &files[index];
+    double start = 0;
+    if (threadArg->stats)
+        start = now_seconds();
+
+    int fd = open(file->path, O_RDONLY);
+    char *data = MAP_FAILED;
+    if (fd == -1) {
+        perror("Error opening file");
+    } else {
+        data = mmap(NULL, file->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+            perror("Error mapping file");
+        close(fd);
+    }
+
+    if (data == MAP_FAILED) {
+        // Publish empty results so the sequencer can skip the file; pzip
+        // still exits with an error once the rest is written
+        input_error = 1;
+        SegmentResult empty = { .owner = -1 };
+        for (size_t k = 0; k < file->num_segments; ++k)
+            publish_result(file->first_seq + k, &empty, threadArg->stats);
+        finish_map_task(threadArg);
+        return;
+    }
+    file->data = data;
 
-        while (queue_is_empty(queue) && !exit_condition) {
-            pthread_cond_wait(&queue->cond_var, &queue->mutex);
+    // Page cache residency, so segments can go to the node holding them
+    unsigned char *resident = NULL;
+    if (threadArg->num_queues > 1 && file->num_segments > 1) {
+        size_t page_size = getpagesize();
+        resident = malloc((file->size + page_size - 1) / page_size);
+        if (resident != NULL && mincore(data, file->size, resident) == -1) {
+            free(resident);
+            resident = NULL;
         }
+    }
 
-        if (exit_condition && queue_is_empty(queue)) {
+    // A single-segment file is compressed right away, unless it is too far
+    // ahead of the sequencer; then it is queued like any other segment
+    FileSegment single = { .file = index, .seq = file->first_seq, .start = 0, .end = file->size };
+    bool compress_now = file->num_segments == 1 && can_start(threadArg, &single);
+    if (file->num_segments == 1 && !compress_now) {
+        pthread_mutex_lock(&threadArg->queue->mutex);
+        enqueue(threadArg->queue, single);
+        pthread_mutex_unlock(&threadArg->queue->mutex);
+    } else if (file->num_segments > 1) {
+        for (size_t k = 0; k < file->num_segments; ++k) {
+            size_t offset = k * segment_size;
+            FileSegment segment = {
+                .file = index,
+                .seq = file->first_seq + k,
+                .start = offset,
+                .end = (offset + segment_size > file->size) ? file->size : offset + segment_size
+            };
+            SharedQueue *queue = &threadArg->queues[segment_queue(data, offset, k, file->num_segments,
+                                                                  threadArg->num_queues, resident)];
+            pthread_mutex_lock(&queue->mutex);
+            enqueue(queue, segment);
             pthread_mutex_unlock(&queue->mutex);
-            break;
         }
+    }
+    free(resident);
 
-        FileSegment segment = dequeue(queue);
-        //printf("Dequeued segment, start: %zu, end: %zu\n", segment.start, segment.end); // Debug Line
-        pthread_mutex_unlock(&queue->mutex);
+    if (threadArg->stats)
+        threadArg->stats->compress_seconds += now_seconds() - start;
 
-        char *segment_data = base_data + segment.start;
-        size_t segment_length = segment.end - segment.start;
-        //printf("Processing segment from %p to %p\n", (void *)segment_data, (void *)(base_data + segment.end)); // Debug Line
+    finish_map_task(threadArg);
 
-        for (size_t i = 0; i < segment_length;) {
-            char current_char = segment_data[i];
-            size_t count = 0;
+    if (compress_now)
+        compress_segment(threadArg, single);
+}
 
-            while (i < segment_length && segment_data[i] == current_char) {
-                count++;
-                i++;
-            }
+// Thread function 
+void *compressPart(void *arg) {
+    ThreadArg *threadArg = (ThreadArg *) arg;
+    WorkerStats *stats = threadArg->stats;
+    struct rusage usage_start;
+    FileSegment segment;
+
+    if (stats)
+        getrusage(RUSAGE_THREAD, &usage_start);
 
-            //printf("Character: %c, Count: %zu, Index: %zu\n", current_char, count, i); // Debug Line
-            pthread_mutex_lock(&lock);
-            fprintf(stdout, "%zu%c\n", count, current_char);
-            pthread_mutex_unlock(&lock);
+    while (true) {
+        double t0 = 0, throttled = 0;
+        if (stats) {
+            t0 = now_seconds();
+            throttled = stats->output_wait_seconds;
         }
+        bool found = next_segment(threadArg, &segment);
+        if (stats)
+            stats->queue_wait_seconds += now_seconds() - t0 - (stats->output_wait_seconds - throttled);
+        if (!found)
+            break;
+
+        if (segment.map)
+            map_file(threadArg, segment.file);
+        else
+            compress_segment(threadArg, segment);
+    }
+
+    if (stats) {
+        struct rusage usage_end;
+        getrusage(RUSAGE_THREAD, &usage_end);
+        stats->minor_faults += usage_end.ru_minflt - usage_start.ru_minflt;
+        stats->major_faults += usage_end.ru_majflt - usage_start.ru_majflt;
     }
 
-    //printf("Thread finishing\n"); // Debug Line
     return NULL;
 }
 
 void queue_init(SharedQueue *q, int capacity) {
     q->segments = malloc(sizeof(FileSegment) * capacity);
     q->capacity = capacity;
-    q->front = q->size = 0; 
-    q->rear = capacity - 1;
+    q->size = 0;
     pthread_mutex_init(&q->mutex, NULL);
     pthread_cond_init(&q->cond_var, NULL);
 }
@@ -104,21 +671,44 @@ int queue_is_empty(SharedQueue *q) {
     return (q->size == 0);
 }
 
+// Heap order: by sequence number, where a map task carries its file's first
+// segment and goes ahead of a segment with the same number
+static bool comes_before(FileSegment *a, FileSegment *b) {
+    if (a->seq != b->seq)
+        return a->seq < b->seq;
+    return a->map && !b->map;
+}
+
 void enqueue(SharedQueue *q, FileSegment item) {
     if (queue_is_full(q))
         return;
-    q->rear = (q->rear + 1) % q->capacity;
-    q->segments[q->rear] = item;
-    q->size = q->size + 1;
+    int i = q->size++;
+    while (i > 0 && comes_before(&item, &q->segments[(i - 1) / 2])) {
+        q->segments[i] = q->segments[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    q->segments[i] = item;
     pthread_cond_signal(&q->cond_var);
 }
 
 FileSegment dequeue(SharedQueue *q) {
     if (queue_is_empty(q))
         return (FileSegment){0}; // Return an empty segment
-    FileSegment item = q->segments[q->front];
-    q->front = (q->front + 1) % q->capacity;
-    q->size = q->size - 1;
+    FileSegment item = q->segments[0];
+    FileSegment last = q->segments[--q->size];
+    int i = 0;
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= q->size)
+            break;
+        if (child + 1 < q->size && comes_before(&q->segments[child + 1], &q->segments[child]))
+            child++;
+        if (!comes_before(&q->segments[child], &last))
+            break;
+        q->segments[i] = q->segments[child];
+        i = child;
+    }
+    q->segments[i] = last;
     return item;
 }
 
@@ -128,82 +718,358 @@ void queue_destroy(SharedQueue *q) {
     pthread_cond_destroy(&q->cond_var);
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <file1> [file2 ...]\n", argv[0]);
-        exit(EXIT_FAILURE);
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t threads] [-s segment_bytes] [--stats[=file]] [--alloc=malloc|umem]\n"
+                    "       [--affinity=compact|scatter] [--cpus=list] <file1> [file2 ...]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+// Writes the per-worker table, and to a stats file also the depth series
+static void report_stats(FILE *out, WorkerStats *stats, int num_threads, bool with_series) {
+    WorkerStats total = {0};
+    double elapsed = now_seconds() - stats_start_time;
+
+    fprintf(out, "pzip stats: %d threads, %.3f s elapsed\n", num_threads, elapsed);
+    fprintf(out, "%-8s %10s %14s %14s %12s %14s %14s %10s %10s\n", "worker", "segments",
+            "bytes_in", "bytes_out", "compress_ms", "queue_wait_ms", "output_wait_ms",
+            "minflt", "majflt");
+    for (int j = 0; j < num_threads; ++j) {
+        WorkerStats *w = &stats[j];
+        fprintf(out, "%-8d %10zu %14zu %14zu %12.3f %14.3f %14.3f %10ld %10ld\n", j,
+                w->segments, w->bytes_in, w->bytes_out, w->compress_seconds * 1e3,
+                w->queue_wait_seconds * 1e3, w->output_wait_seconds * 1e3,
+                w->minor_faults, w->major_faults);
+        total.segments += w->segments;
+        total.bytes_in += w->bytes_in;
+        total.bytes_out += w->bytes_out;
+        total.compress_seconds += w->compress_seconds;
+        total.queue_wait_seconds += w->queue_wait_seconds;
+        total.output_wait_seconds += w->output_wait_seconds;
+        total.minor_faults += w->minor_faults;
+        total.major_faults += w->major_faults;
+    }
+    fprintf(out, "%-8s %10zu %14zu %14zu %12.3f %14.3f %14.3f %10ld %10ld\n", "total",
+            total.segments, total.bytes_in, total.bytes_out, total.compress_seconds * 1e3,
+            total.queue_wait_seconds * 1e3, total.output_wait_seconds * 1e3,
+            total.minor_faults, total.major_faults);
+    fprintf(out, "sequencer: waited %.3f ms for in-order segments\n", sequencer_wait_seconds * 1e3);
+    if (alloc_backend == ALLOC_UMEM) {
+        size_t fallbacks = 0;
+        for (int j = 0; j < num_threads; ++j)
+            fallbacks += stats[j].arena_fallbacks;
+        fprintf(out, "umem arenas: %zu output buffers fell back to malloc\n", fallbacks);
     }
 
+    if (depth_sample_count > 0) {
+        int max_depth = 0;
+        double sum = 0;
+        for (size_t k = 0; k < depth_sample_count; ++k) {
+            sum += depth_samples[k].depth;
+            if (depth_samples[k].depth > max_depth)
+                max_depth = depth_samples[k].depth;
+        }
+        fprintf(out, "queue depth: %zu samples, mean %.1f, max %d\n",
+                depth_sample_count, sum / depth_sample_count, max_depth);
+    }
+
+    if (with_series) {
+        fprintf(out, "# time_ms depth\n");
+        for (size_t k = 0; k < depth_sample_count; ++k)
+            fprintf(out, "%.3f %d\n", depth_samples[k].time * 1e3, depth_samples[k].depth);
+    }
+}
+
+int main(int argc, char *argv[]) {
     int num_threads = get_nprocs(); 
-    const size_t segment_size = 1024 * 1024; // 1MB per segment
 
-    for (int i = 1; i < argc; ++i) {
-        int fd = open(argv[i], O_RDONLY);
-        if (fd == -1) {
-            perror("Error opening file");
-            continue;
+    bool collect_stats = false;
+    const char *stats_path = NULL;
+    bool threads_given = false;
+    PinPolicy pin_policy = PIN_NONE;
+    const char *cpu_list = NULL;
+
+    static const struct option long_options[] = {
+        {"stats", optional_argument, NULL, 'S'},
+        {"affinity", required_argument, NULL, 'A'},
+        {"cpus", required_argument, NULL, 'C'},
+        {"alloc", required_argument, NULL, 'M'},
+        {NULL, 0, NULL, 0}
+    };
+
+    // -t and -s let the benchmark sweep thread counts and segment sizes
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:s:", long_options, NULL)) != -1) {
+        char *end;
+        switch (opt) {
+            case 'S':
+                collect_stats = true;
+                stats_path = optarg;
+                break;
+            case 'A':
+                if (strcmp(optarg, "compact") == 0)
+                    pin_policy = PIN_COMPACT;
+                else if (strcmp(optarg, "scatter") == 0)
+                    pin_policy = PIN_SCATTER;
+                else
+                    usage(argv[0]);
+                break;
+            case 'C':
+                cpu_list = optarg;
+                break;
+            case 'M':
+                if (strcmp(optarg, "malloc") == 0)
+                    alloc_backend = ALLOC_MALLOC;
+                else if (strcmp(optarg, "umem") == 0)
+                    alloc_backend = ALLOC_UMEM;
+                else
+                    usage(argv[0]);
+                break;
+            case 't':
+                num_threads = (int) strtol(optarg, &end, 10);
+                if (*end != '\0' || num_threads < 1)
+                    usage(argv[0]);
+                threads_given = true;
+                break;
+            case 's':
+                segment_size = strtoull(optarg, &end, 10);
+                if (*end != '\0' || segment_size == 0)
+                    usage(argv[0]);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc)
+        usage(argv[0]);
+
+    // Pinning only ever uses CPUs we are allowed on, so cgroup/taskset
+    // limits are honored; --cpus narrows that set further
+    if (cpu_list != NULL && pin_policy == PIN_NONE)
+        pin_policy = PIN_COMPACT;
+
+    int *worker_cpu = NULL;
+    int num_queues = 1;
+    for (int n = 0; n < MAX_NODES; ++n)
+        node_queue[n] = -1;
+    node_queue[0] = 0;
+
+    if (pin_policy != PIN_NONE) {
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+            perror("Error getting CPU affinity");
+            exit(EXIT_FAILURE);
         }
+        if (cpu_list != NULL) {
+            cpu_set_t requested;
+            if (parse_cpu_list(cpu_list, &requested) == -1)
+                usage(argv[0]);
+            CPU_AND(&allowed, &allowed, &requested);
+        }
+        if (!threads_given)
+            num_threads = CPU_COUNT(&allowed);
+
+        load_numa_topology();
+        worker_cpu = malloc(sizeof(int) * (num_threads > 0 ? num_threads : 1));
+        if (worker_cpu == NULL || plan_worker_cpus(pin_policy, &allowed, num_threads, worker_cpu) == -1) {
+            fprintf(stderr, "No usable CPUs in the requested set\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // One queue per node that actually has workers on it
+        node_queue[0] = -1;
+        num_queues = 0;
+        for (int j = 0; j < num_threads; ++j) {
+            int node = cpu_node[worker_cpu[j]];
+            if (node_queue[node] == -1)
+                node_queue[node] = num_queues++;
+        }
+    }
 
+    WorkerStats *stats = NULL;
+    if (collect_stats) {
+        stats = calloc(num_threads, sizeof(WorkerStats));
+        if (stats == NULL) {
+            perror("Error allocating stats");
+            exit(EXIT_FAILURE);
+        }
+        stats_start_time = now_seconds();
+    }
+
+    // Only sizes are needed up front to number every segment of the
+    // concatenated stream; opening and mapping is left to the workers
+    int num_files = argc - optind;
+    files = calloc(num_files, sizeof(InputFile));
+    if (files == NULL) {
+        perror("Error allocating file table");
+        exit(EXIT_FAILURE);
+    }
+    size_t total_segments = 0;
+    for (int i = 0; i < num_files; ++i) {
         struct stat sb;
-        if (fstat(fd, &sb) == -1) {
-            perror("Error getting file size");
-            close(fd);
+        files[i].path = argv[optind + i];
+        if (stat(files[i].path, &sb) == -1) {
+            perror("Error opening file");
             continue;
         }
+        if (sb.st_size == 0) // Skip empty files
+            continue;
+        files[i].size = sb.st_size;
+        files[i].first_seq = total_segments;
+        files[i].num_segments = (files[i].size + segment_size - 1) / segment_size;
+        files[i].remaining = files[i].num_segments;
+        total_segments += files[i].num_segments;
+        pending_maps++;
+    }
+
+    output_window = (size_t) OUTPUT_WINDOW_PER_THREAD * num_threads;
+    results = calloc(total_segments ? total_segments : 1, sizeof(SegmentResult));
+    SharedQueue queues[num_queues];
+    for (int q = 0; q < num_queues; ++q)
+        queue_init(&queues[q], total_segments + pending_maps + 1);
+    if (results == NULL) {
+        perror("Error allocating results");
+        exit(EXIT_FAILURE);
+    }
 
-        if (sb.st_size == 0) { // Skip empty files
-            close(fd);
+    // Map tasks are spread over the queues so files are mapped concurrently
+    int next_queue = 0;
+    for (int i = 0; i < num_files; ++i) {
+        if (files[i].num_segments == 0)
             continue;
+        FileSegment task = { .file = i, .seq = files[i].first_seq, .map = true };
+        enqueue(&queues[next_queue], task);
+        next_queue = (next_queue + 1) % num_queues;
+    }
+    if (pending_maps == 0)
+        exit_condition = 1;
+
+    if (alloc_backend == ALLOC_UMEM) {
+        arenas = calloc(num_threads, sizeof(WorkerArena));
+        if (arenas == NULL) {
+            perror("Error allocating arenas");
+            exit(EXIT_FAILURE);
+        }
+        // A segment's output is at most three bytes per input byte
+        size_t arena_size = ARENA_SEGMENTS * (segment_size * 3 + 64);
+        for (int j = 0; j < num_threads; ++j) {
+            arenas[j].heap = uheap_create(arena_size, FIRST_FIT);
+            if (arenas[j].heap == NULL)
+                exit(EXIT_FAILURE);
+            pthread_mutex_init(&arenas[j].lock, NULL);
         }
+    }
 
-        char *data = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
-        if (data == MAP_FAILED) {
-            perror("Error mapping file");
-            close(fd);
-            continue;
+    pthread_t threads[num_threads];
+    ThreadArg args[num_threads];
+    for (int j = 0; j < num_threads; ++j) {
+        int home = worker_cpu ? node_queue[cpu_node[worker_cpu[j]]] : 0;
+        args[j].queue = &queues[home];
+        args[j].queues = queues;
+        args[j].num_queues = num_queues;
+        args[j].home = home;
+        args[j].index = j;
+        args[j].stats = stats ? &stats[j] : NULL;
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (worker_cpu) {
+            cpu_set_t cpu;
+            CPU_ZERO(&cpu);
+            CPU_SET(worker_cpu[j], &cpu);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu);
         }
+        if (pthread_create(&threads[j], &attr, compressPart, &args[j]) != 0) {
+            perror("Error creating thread");
+            exit(EXIT_FAILURE);
+        }
+        pthread_attr_destroy(&attr);
+    }
 
-        size_t num_segments = (sb.st_size + segment_size - 1) / segment_size;
-        SharedQueue queue;
-        queue_init(&queue, num_segments);
+    // Sequencer: write segments in order, joining the run that ends one
+    // segment (or file) with the run that starts the next
+    static char stdout_buffer[1 << 20];
+    setvbuf(stdout, stdout_buffer, _IOFBF, sizeof(stdout_buffer));
+    char encoded[48];
+    Run pending = {0};
+    for (size_t seq = 0; seq < total_segments; ++seq) {
+        pthread_mutex_lock(&results_lock);
+        __atomic_store_n(&next_to_write, seq, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&results_lock);
 
-        pthread_t threads[num_threads];
-        ThreadArg args[num_threads];
-        for (int j = 0; j < num_threads; ++j) {
-            args[j].queue = &queue;
-            args[j].data = data; // Correctly pass the base pointer
-            if (pthread_create(&threads[j], NULL, compressPart, &args[j]) != 0) {
-                perror("Error creating thread");
-                // Handle thread creation failure
-            }
+        // The output window moved; wake workers that were held back
+        for (int q = 0; q < num_queues; ++q) {
+            pthread_mutex_lock(&queues[q].mutex);
+            pthread_cond_broadcast(&queues[q].cond_var);
+            pthread_mutex_unlock(&queues[q].mutex);
         }
 
-        for (size_t offset = 0; offset < sb.st_size; offset += segment_size) {
-            FileSegment segment = {
-                .start = offset,
-                .end = (offset + segment_size > sb.st_size) ? sb.st_size : offset + segment_size
-            };
-            enqueue(&queue, segment);
+        pthread_mutex_lock(&results_lock);
+        if (!results[seq].ready) {
+            double before = stats ? now_seconds() : 0;
+            while (!results[seq].ready)
+                pthread_cond_wait(&results_cond, &results_lock);
+            if (stats)
+                sequencer_wait_seconds += now_seconds() - before;
         }
+        SegmentResult result = results[seq];
+        pthread_mutex_unlock(&results_lock);
 
-        pthread_mutex_lock(&queue.mutex);
-        exit_condition = 1;
-        pthread_cond_broadcast(&queue.cond_var);
-        pthread_mutex_unlock(&queue.mutex);
+        if (result.num_runs > 0) {
+            if (pending.count > 0 && pending.c == result.first.c) {
+                pending.count += result.first.count;
+            } else {
+                if (pending.count > 0)
+                    fwrite(encoded, 1, encode_run(encoded, pending), stdout);
+                pending = result.first;
+            }
+            if (result.num_runs > 1) {
+                fwrite(encoded, 1, encode_run(encoded, pending), stdout);
+                fwrite(result.body, 1, result.body_len, stdout);
+                pending = result.last;
+            }
+        }
+        release_body(result.body, result.owner);
+    }
+    if (pending.count > 0)
+        fwrite(encoded, 1, encode_run(encoded, pending), stdout);
 
+    for (int j = 0; j < num_threads; ++j) {
+        if (pthread_join(threads[j], NULL) != 0) {
+            perror("Error joining thread");
+        }
+    }
+
+    for (int q = 0; q < num_queues; ++q)
+        queue_destroy(&queues[q]);
+    free(results);
+    free(files);
+    if (arenas != NULL) {
         for (int j = 0; j < num_threads; ++j) {
-            if (pthread_join(threads[j], NULL) != 0) {
-                perror("Error joining thread");
-            }
+            uheap_destroy(arenas[j].heap);
+            pthread_mutex_destroy(&arenas[j].lock);
         }
+        free(arenas);
+    }
 
-        munmap(data, sb.st_size);
-        close(fd);
-        queue_destroy(&queue);
+    if (stats) {
+        fflush(stdout);
+        FILE *out = stats_path ? fopen(stats_path, "w") : stderr;
+        if (out == NULL) {
+            perror("Error opening stats file");
+        } else {
+            report_stats(out, stats, num_threads, stats_path != NULL);
+            if (out != stderr)
+                fclose(out);
+        }
+        free(stats);
+        free(depth_samples);
     }
 
-    pthread_mutex_destroy(&lock); // Destroy the lock
-    return 0;
+    free(worker_cpu);
+    pthread_mutex_destroy(&results_lock);
+    pthread_cond_destroy(&results_cond);
+    return input_error ? EXIT_FAILURE : 0;
 }
 
 
@@ -0,0 +1,511 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/sysinfo.h>
+
+// Benchmark driver for pzip.
+//
+// Generates reproducible corpora in a scratch directory, runs the pzip binary
+// over every thread count from 1..N and every requested segment size, and
+// reports throughput, speedup, compression ratio and peak RSS as CSV or JSON.
+// Every run is checked by decoding pzip's output and comparing it byte for
+// byte with the concatenated input files. With -a, the sweep is repeated for
+// each of pzip's output buffer allocators.
+
+#define MAX_SEGMENT_SIZES 16
+#define MAX_ALLOCATORS 4
+#define SMALL_FILE_SIZE (4 * 1024)
+#define MAX_SMALL_FILES 2048
+
+typedef struct {
+    const char *name;
+    char **files;
+    int num_files;
+    size_t total_bytes;
+} Corpus;
+
+typedef struct {
+    const char *corpus;
+    int num_files;
+    size_t input_bytes;
+    size_t segment_size;
+    int threads;
+    const char *allocator;
+    double seconds;
+    double speedup;
+    size_t output_bytes;
+    long peak_rss_kb;
+    bool roundtrip_ok;
+} Result;
+
+static uint64_t rng_state;
+
+// xorshift64*, seeded per corpus so every run sees identical data
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *xstrdup_printf(const char *fmt, const char *a, int b) {
+    char buf[4096];
+    snprintf(buf, sizeof(buf), fmt, a, b);
+    return strdup(buf);
+}
+
+static void corpus_add_file(Corpus *c, char *path, size_t bytes) {
+    c->files = realloc(c->files, sizeof(char *) * (c->num_files + 1));
+    if (c->files == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    c->files[c->num_files++] = path;
+    c->total_bytes += bytes;
+}
+
+static FILE *open_corpus_file(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    return fp;
+}
+
+static void fill_same(FILE *fp, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++)
+        putc('a', fp);
+}
+
+static void fill_short_runs(FILE *fp, size_t bytes) {
+    static const char alphabet[] = "abcd";
+    size_t written = 0;
+    while (written < bytes) {
+        char c = alphabet[rng_next() % 4];
+        size_t run = 1 + rng_next() % 8;
+        for (size_t i = 0; i < run && written < bytes; i++, written++)
+            putc(c, fp);
+    }
+}
+
+static void fill_random(FILE *fp, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++)
+        putc((int) (rng_next() & 0xff), fp);
+}
+
+static void fill_text(FILE *fp, size_t bytes) {
+    static const char *words[] = {
+        "the", "process", "thread", "memory", "kernel", "scheduler", "page",
+        "lock", "queue", "segment", "buffer", "file", "system", "call", "  ",
+        "aaa", "zzzz", "bookkeeping", "see", "all",
+    };
+    const int num_words = sizeof(words) / sizeof(words[0]);
+    size_t written = 0;
+    while (written < bytes) {
+        const char *w = words[rng_next() % num_words];
+        for (; *w && written < bytes; w++, written++)
+            putc(*w, fp);
+        if (written < bytes) {
+            putc(rng_next() % 12 == 0 ? '\n' : ' ', fp);
+            written++;
+        }
+    }
+}
+
+static void make_single_file_corpus(Corpus *c, const char *dir, const char *name,
+                                    size_t bytes, uint64_t seed,
+                                    void (*fill)(FILE *, size_t)) {
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    rng_state = seed;
+
+    char buf[4096];
+    snprintf(buf, sizeof(buf), "%s/%s.dat", dir, name);
+    char *path = strdup(buf);
+
+    FILE *fp = open_corpus_file(path);
+    fill(fp, bytes);
+    fclose(fp);
+    corpus_add_file(c, path, bytes);
+}
+
+static void make_small_files_corpus(Corpus *c, const char *dir, size_t bytes, uint64_t seed) {
+    memset(c, 0, sizeof(*c));
+    c->name = "smallfiles";
+    rng_state = seed;
+
+    int count = (int) (bytes / SMALL_FILE_SIZE);
+    if (count < 1)
+        count = 1;
+    if (count > MAX_SMALL_FILES)
+        count = MAX_SMALL_FILES;
+
+    for (int i = 0; i < count; i++) {
+        char *path = xstrdup_printf("%s/small.%d", dir, i);
+        // Vary the sizes a little so files don't all end on the same boundary
+        size_t size = SMALL_FILE_SIZE / 2 + rng_next() % SMALL_FILE_SIZE;
+        FILE *fp = open_corpus_file(path);
+        fill_text(fp, size);
+        fclose(fp);
+        corpus_add_file(c, path, size);
+    }
+}
+
+// Streams the corpus files back as one concatenated byte sequence
+typedef struct {
+    const Corpus *corpus;
+    int index;
+    FILE *fp;
+} CorpusReader;
+
+static int corpus_getc(CorpusReader *r) {
+    while (true) {
+        if (r->fp == NULL) {
+            if (r->index >= r->corpus->num_files)
+                return EOF;
+            r->fp = fopen(r->corpus->files[r->index++], "r");
+            if (r->fp == NULL)
+                return EOF;
+        }
+        int c = getc(r->fp);
+        if (c != EOF)
+            return c;
+        fclose(r->fp);
+        r->fp = NULL;
+    }
+}
+
+// Decodes pzip's "<count><char>\n" records and compares them with the input
+static bool roundtrip_matches(const char *output_path, const Corpus *corpus) {
+    FILE *out = fopen(output_path, "r");
+    if (out == NULL)
+        return false;
+
+    CorpusReader reader = { .corpus = corpus };
+    bool ok = true;
+    int c;
+    while (ok && (c = getc(out)) != EOF) {
+        size_t count = 0;
+        if (c < '0' || c > '9') {
+            ok = false;
+            break;
+        }
+        int last_digit = c;
+        while (c >= '0' && c <= '9') {
+            count = count * 10 + (c - '0');
+            last_digit = c;
+            c = getc(out);
+        }
+
+        // The run character may itself be a digit or a newline: "125\n" is
+        // twelve '5's, while "12\n\n" is twelve newlines.
+        int ch;
+        if (c == '\n') {
+            int next = getc(out);
+            if (next == '\n') {
+                ch = '\n';
+            } else {
+                if (next != EOF)
+                    ungetc(next, out);
+                ch = last_digit;
+                count /= 10;
+            }
+        } else {
+            ch = c;
+            if (getc(out) != '\n')
+                ch = EOF;
+        }
+        if (count == 0 || ch == EOF) {
+            ok = false;
+            break;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (corpus_getc(&reader) != ch) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    if (ok && corpus_getc(&reader) != EOF)
+        ok = false;
+
+    if (reader.fp != NULL)
+        fclose(reader.fp);
+    fclose(out);
+    return ok;
+}
+
+// Runs pzip once with stdout sent to output_path; returns wall seconds or -1
+static double run_pzip(const char *pzip, const Corpus *corpus, int threads,
+                       size_t segment_size, const char *allocator,
+                       const char *output_path, long *peak_rss_kb) {
+    char threads_arg[32], segment_arg[32], alloc_arg[64];
+    snprintf(threads_arg, sizeof(threads_arg), "%d", threads);
+    snprintf(segment_arg, sizeof(segment_arg), "%zu", segment_size);
+    snprintf(alloc_arg, sizeof(alloc_arg), "--alloc=%s", allocator);
+
+    char **argv = malloc(sizeof(char *) * (corpus->num_files + 7));
+    int n = 0;
+    argv[n++] = (char *) pzip;
+    argv[n++] = "-t";
+    argv[n++] = threads_arg;
+    argv[n++] = "-s";
+    argv[n++] = segment_arg;
+    argv[n++] = alloc_arg;
+    for (int i = 0; i < corpus->num_files; i++)
+        argv[n++] = corpus->files[i];
+    argv[n] = NULL;
+
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    } else if (pid == 0) {
+        int fd = open(output_path, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1) {
+            perror(output_path);
+            _exit(127);
+        }
+        close(fd);
+        execv(pzip, argv);
+        perror(pzip);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) == -1) {
+        perror("wait4");
+        exit(EXIT_FAILURE);
+    }
+    double elapsed = now_seconds() - start;
+    free(argv);
+
+    *peak_rss_kb = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return elapsed;
+}
+
+static void print_csv(const Result *results, int count) {
+    printf("corpus,files,input_bytes,segment_size,threads,allocator,seconds,mb_per_s,speedup,"
+           "ratio,peak_rss_kb,roundtrip\n");
+    for (int i = 0; i < count; i++) {
+        const Result *r = &results[i];
+        printf("%s,%d,%zu,%zu,%d,%s,%.6f,%.2f,%.3f,%.4f,%ld,%s\n",
+               r->corpus, r->num_files, r->input_bytes, r->segment_size, r->threads,
+               r->allocator, r->seconds, r->input_bytes / 1e6 / r->seconds, r->speedup,
+               (double) r->output_bytes / r->input_bytes, r->peak_rss_kb,
+               r->roundtrip_ok ? "ok" : "FAIL");
+    }
+}
+
+static void print_json(const Result *results, int count) {
+    printf("[\n");
+    for (int i = 0; i < count; i++) {
+        const Result *r = &results[i];
+        printf("  {\"corpus\": \"%s\", \"files\": %d, \"input_bytes\": %zu, "
+               "\"segment_size\": %zu, \"threads\": %d, \"allocator\": \"%s\", \"seconds\": %.6f, "
+               "\"mb_per_s\": %.2f, \"speedup\": %.3f, \"ratio\": %.4f, "
+               "\"peak_rss_kb\": %ld, \"roundtrip\": %s}%s\n",
+               r->corpus, r->num_files, r->input_bytes, r->segment_size, r->threads,
+               r->allocator, r->seconds, r->input_bytes / 1e6 / r->seconds, r->speedup,
+               (double) r->output_bytes / r->input_bytes, r->peak_rss_kb,
+               r->roundtrip_ok ? "true" : "false", i + 1 < count ? "," : "");
+    }
+    printf("]\n");
+}
+
+static int parse_segment_sizes(char *list, size_t *sizes) {
+    int count = 0;
+    for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (count == MAX_SEGMENT_SIZES)
+            break;
+        char *end;
+        size_t size = strtoull(tok, &end, 10);
+        if (*end == 'k' || *end == 'K')
+            size *= 1024, end++;
+        else if (*end == 'm' || *end == 'M')
+            size *= 1024 * 1024, end++;
+        if (*end != '\0' || size == 0)
+            return -1;
+        sizes[count++] = size;
+    }
+    return count;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-p pzip] [-t max_threads] [-s sizes] [-a allocators] [-m MB]\n"
+            "          [-r reps] [-f csv|json] [-d dir]\n"
+            "  -p  path to the pzip binary (default ./pzip)\n"
+            "  -t  sweep thread counts 1..max_threads (default: nprocs)\n"
+            "  -s  comma separated segment sizes, k/m suffixes allowed (default 64k,1m,4m)\n"
+            "  -a  comma separated pzip --alloc back-ends (default malloc)\n"
+            "  -m  size of each generated corpus in MB (default 64)\n"
+            "  -r  repetitions per configuration, best time is kept (default 3)\n"
+            "  -f  output format (default csv)\n"
+            "  -d  scratch directory for corpora (default: a fresh /tmp directory)\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    const char *pzip = "./pzip";
+    int max_threads = get_nprocs();
+    size_t segment_sizes[MAX_SEGMENT_SIZES];
+    int num_segment_sizes = 0;
+    char *allocators[MAX_ALLOCATORS] = { "malloc" };
+    int num_allocators = 1;
+    size_t corpus_bytes = 64 * 1024 * 1024;
+    int reps = 3;
+    bool json = false;
+    char *dir = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:t:s:a:m:r:f:d:")) != -1) {
+        switch (opt) {
+            case 'p': pzip = optarg; break;
+            case 't': max_threads = atoi(optarg); break;
+            case 's': num_segment_sizes = parse_segment_sizes(optarg, segment_sizes); break;
+            case 'a':
+                num_allocators = 0;
+                for (char *tok = strtok(optarg, ","); tok != NULL && num_allocators < MAX_ALLOCATORS;
+                     tok = strtok(NULL, ","))
+                    allocators[num_allocators++] = tok;
+                break;
+            case 'm': corpus_bytes = strtoull(optarg, NULL, 10) * 1024 * 1024; break;
+            case 'r': reps = atoi(optarg); break;
+            case 'f':
+                if (strcmp(optarg, "json") == 0)
+                    json = true;
+                else if (strcmp(optarg, "csv") != 0)
+                    usage(argv[0]);
+                break;
+            case 'd': dir = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (max_threads < 1 || reps < 1 || corpus_bytes == 0 || num_segment_sizes < 0 ||
+        num_allocators == 0)
+        usage(argv[0]);
+    if (num_segment_sizes == 0) {
+        segment_sizes[0] = 64 * 1024;
+        segment_sizes[1] = 1024 * 1024;
+        segment_sizes[2] = 4 * 1024 * 1024;
+        num_segment_sizes = 3;
+    }
+
+    char dir_template[] = "/tmp/pzip_bench.XXXXXX";
+    if (dir == NULL) {
+        dir = mkdtemp(dir_template);
+        if (dir == NULL) {
+            perror("mkdtemp");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    fprintf(stderr, "Generating corpora in %s...\n", dir);
+    Corpus corpora[5];
+    make_single_file_corpus(&corpora[0], dir, "same", corpus_bytes, 1, fill_same);
+    make_single_file_corpus(&corpora[1], dir, "runs", corpus_bytes, 2, fill_short_runs);
+    make_single_file_corpus(&corpora[2], dir, "random", corpus_bytes, 3, fill_random);
+    make_single_file_corpus(&corpora[3], dir, "text", corpus_bytes, 4, fill_text);
+    make_small_files_corpus(&corpora[4], dir, corpus_bytes, 5);
+    const int num_corpora = sizeof(corpora) / sizeof(corpora[0]);
+
+    char output_path[4096];
+    snprintf(output_path, sizeof(output_path), "%s/pzip.out", dir);
+
+    int max_results = num_corpora * num_segment_sizes * num_allocators * max_threads;
+    Result *results = calloc(max_results, sizeof(Result));
+    int num_results = 0;
+    int failures = 0;
+
+    for (int c = 0; c < num_corpora; c++) {
+        for (int s = 0; s < num_segment_sizes; s++) {
+            for (int a = 0; a < num_allocators; a++) {
+                double baseline = 0;
+                for (int t = 1; t <= max_threads; t++) {
+                    Result *r = &results[num_results++];
+                    r->corpus = corpora[c].name;
+                    r->num_files = corpora[c].num_files;
+                    r->input_bytes = corpora[c].total_bytes;
+                    r->segment_size = segment_sizes[s];
+                    r->threads = t;
+                    r->allocator = allocators[a];
+                    r->seconds = -1;
+
+                    for (int rep = 0; rep < reps; rep++) {
+                        long rss;
+                        double elapsed = run_pzip(pzip, &corpora[c], t, segment_sizes[s],
+                                                  allocators[a], output_path, &rss);
+                        if (elapsed < 0) {
+                            r->seconds = -1;
+                            break;
+                        }
+                        if (r->seconds < 0 || elapsed < r->seconds)
+                            r->seconds = elapsed;
+                        if (rss > r->peak_rss_kb)
+                            r->peak_rss_kb = rss;
+                    }
+
+                    if (r->seconds < 0) {
+                        fprintf(stderr, "pzip failed on %s (threads=%d, segment=%zu, alloc=%s)\n",
+                                r->corpus, t, segment_sizes[s], allocators[a]);
+                        exit(EXIT_FAILURE);
+                    }
+
+                    struct stat sb;
+                    r->output_bytes = (stat(output_path, &sb) == 0) ? sb.st_size : 0;
+                    r->roundtrip_ok = roundtrip_matches(output_path, &corpora[c]);
+                    if (!r->roundtrip_ok) {
+                        failures++;
+                        fprintf(stderr, "Round trip mismatch on %s (threads=%d, segment=%zu, alloc=%s)\n",
+                                r->corpus, t, segment_sizes[s], allocators[a]);
+                    }
+
+                    if (t == 1)
+                        baseline = r->seconds;
+                    r->speedup = baseline / r->seconds;
+                }
+            }
+        }
+    }
+
+    if (json)
+        print_json(results, num_results);
+    else
+        print_csv(results, num_results);
+
+    unlink(output_path);
+    for (int c = 0; c < num_corpora; c++) {
+        for (int i = 0; i < corpora[c].num_files; i++) {
+            unlink(corpora[c].files[i]);
+            free(corpora[c].files[i]);
+        }
+        free(corpora[c].files);
+    }
+    if (dir == dir_template)
+        rmdir(dir);
+    free(results);
+
+    return failures == 0 ? 0 : EXIT_FAILURE;
+}
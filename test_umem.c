@@ -92,12 +92,49 @@ void test_freeing_memory() {
     printf("Memory freeing test completed.\n");
 }
 
+void test_private_heaps() {
+    printf("Testing private heaps...\n");
+
+    UHeap *heap1 = uheap_create(64 * 1024, FIRST_FIT);
+    UHeap *heap2 = uheap_create(64 * 1024, NEXT_FIT);
+    assert(heap1 != NULL && heap2 != NULL);
+
+    // Blocks come from separate regions and do not disturb the global heap
+    char *a = uheap_malloc(heap1, 1000);
+    char *b = uheap_malloc(heap2, 1000);
+    assert(a != NULL && b != NULL);
+    assert(a + 1000 <= b || b + 1000 <= a);
+    memset(a, 'a', 1000);
+    memset(b, 'b', 1000);
+    assert(a[999] == 'a' && b[0] == 'b');
+
+    // Frees are checked against the owning heap
+    assert(uheap_free(heap2, a) == -1);
+    assert(uheap_free(heap1, a) == 0);
+
+    // Fill a heap, then release everything in bulk and fill it again
+    int count = 0;
+    while (uheap_malloc(heap2, 4096) != NULL)
+        count++;
+    assert(count > 0);
+    uheap_reset(heap2);
+    for (int i = 0; i < count; i++)
+        assert(uheap_malloc(heap2, 4096) != NULL);
+
+    uheap_dump(heap1);
+    uheap_destroy(heap1);
+    uheap_destroy(heap2);
+
+    printf("Private heap test completed.\n");
+}
+
 int main() {
     // Run initialization test
     test_initialization();
     test_allocation_strategies();
     // Run memory freeing test
     test_freeing_memory();
+    test_private_heaps();
 
     return 0;
 }
@@ -16,39 +16,39 @@ typedef struct BlockHeader {
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 #define BLOCK_SIZE ALIGN(sizeof(BlockHeader))
 
-static uint8_t fake_heap[1024 * 1024]; // 1MB of fake heap
-static BlockHeader *heap_list = NULL; 
-static BlockHeader *next_fit_ptr = NULL; 
-static int allocation_algorithm = FIRST_FIT; 
-static int allocator_initialized = 0;        
-static size_t size_of_region = 0;     
-static void *memory_region = NULL; 
-
-static BlockHeader *find_best_fit(size_t size);
-static BlockHeader *find_worst_fit(size_t size);
-static BlockHeader *find_first_fit(size_t size);
-static BlockHeader *find_next_fit(size_t size);
+// All allocator state lives in a heap, so callers can keep private heaps
+// (e.g. one per thread) next to the global one used by umalloc/ufree
+struct UHeap {
+    BlockHeader *heap_list;
+    BlockHeader *next_fit_ptr;
+    int allocation_algorithm;
+    int allocator_initialized;
+    size_t size_of_region;
+    void *memory_region;
+};
+
+static UHeap default_heap = { .allocation_algorithm = FIRST_FIT };
+
+static BlockHeader *find_best_fit(UHeap *heap, size_t size);
+static BlockHeader *find_worst_fit(UHeap *heap, size_t size);
+static BlockHeader *find_first_fit(UHeap *heap, size_t size);
+static BlockHeader *find_next_fit(UHeap *heap, size_t size);
 static void split_block(BlockHeader *block, size_t size);
-static BlockHeader *coalesce(BlockHeader *block);
+static BlockHeader *coalesce(UHeap *heap, BlockHeader *block);
 
 static void reset_globals() {
-    heap_list = NULL;
-    next_fit_ptr = NULL;
-    allocator_initialized = 0;
-    size_of_region = 0;
-    memory_region = NULL;
+    default_heap.heap_list = NULL;
+    default_heap.next_fit_ptr = NULL;
+    default_heap.allocator_initialized = 0;
+    default_heap.size_of_region = 0;
+    default_heap.memory_region = NULL;
 }
 
-int umeminit(size_t sizeOfRegion, int allocationAlgo) {
-    // Resetting global variables
-    reset_globals();
-
-    if (sizeOfRegion < BLOCK_SIZE) {
-        fprintf(stderr, "Requested size is too small\n");
-        return -1; 
-    }
-    
-    allocation_algorithm = allocationAlgo;
+// Maps a region and sets it up as one free block. Without a heap to fill
+// in, the heap struct itself is stored at the start of the region.
+static UHeap *heap_map(UHeap *heap, size_t sizeOfRegion, int allocationAlgo) {
+    size_t header_size = (heap == NULL) ? ALIGN(sizeof(UHeap)) : 0;
+    sizeOfRegion += header_size;
 
     // This aligns sizeOfRegion to page size
     size_t page_size = getpagesize();
@@ -64,44 +64,84 @@ int umeminit(size_t sizeOfRegion, int allocationAlgo) {
 
     if (mapped_area == MAP_FAILED) {
         perror("mmap failed");
-        return -1;
+        return NULL;
     }
 
-    //Debug line
-    //printf("Memory allocated successfully\n");
+    if (heap == NULL) {
+        heap = (UHeap *)mapped_area;
+    }
 
     // Initializing the heap list 
-    heap_list = (BlockHeader *)mapped_area;
-    heap_list->size = sizeOfRegion - BLOCK_SIZE;
-    heap_list->next = NULL;
-    heap_list->free = 1;
-    next_fit_ptr = heap_list; 
-
-    size_of_region = sizeOfRegion;
-    allocator_initialized = 1;
+    heap->allocation_algorithm = allocationAlgo;
+    heap->memory_region = mapped_area;
+    heap->size_of_region = sizeOfRegion;
+    heap->heap_list = (BlockHeader *)((char *)mapped_area + header_size);
+    uheap_reset(heap);
+    heap->allocator_initialized = 1;
+    return heap;
+}
+
+UHeap *uheap_create(size_t sizeOfRegion, int allocationAlgo) {
+    if (sizeOfRegion < BLOCK_SIZE) {
+        fprintf(stderr, "Requested size is too small\n");
+        return NULL; 
+    }
+    return heap_map(NULL, sizeOfRegion, allocationAlgo);
+}
+
+void uheap_reset(UHeap *heap) {
+    size_t header_size = (char *)heap->heap_list - (char *)heap->memory_region;
+    heap->heap_list->size = heap->size_of_region - header_size - BLOCK_SIZE;
+    heap->heap_list->next = NULL;
+    heap->heap_list->free = 1;
+    heap->next_fit_ptr = heap->heap_list;
+}
+
+void uheap_destroy(UHeap *heap) {
+    if (heap != NULL) {
+        munmap(heap->memory_region, heap->size_of_region);
+    }
+}
+
+int umeminit(size_t sizeOfRegion, int allocationAlgo) {
+    // Resetting global variables
+    reset_globals();
+
+    if (sizeOfRegion < BLOCK_SIZE) {
+        fprintf(stderr, "Requested size is too small\n");
+        return -1; 
+    }
+    
+    if (heap_map(&default_heap, sizeOfRegion, allocationAlgo) == NULL) {
+        return -1;
+    }
     return 0; 
 }
 
 void *umalloc(size_t size) {
-    if (heap_list == NULL || size == 0) {
+    return uheap_malloc(&default_heap, size);
+}
+
+void *uheap_malloc(UHeap *heap, size_t size) {
+    if (heap == NULL || heap->heap_list == NULL || size == 0) {
         return NULL;
     }
 
     size = ALIGN(size);
     BlockHeader *block;
 
-    switch (allocation_algorithm) {
+    switch (heap->allocation_algorithm) {
         case BEST_FIT:
-            block = find_best_fit(size);
+            block = find_best_fit(heap, size);
             break;
         case WORST_FIT:
-            block = find_worst_fit(size);
+            block = find_worst_fit(heap, size);
             break;
         case FIRST_FIT:
-            block = find_first_fit(size);
+            block = find_first_fit(heap, size);
             break;
         case NEXT_FIT:
-            block = find_next_fit(size);
+            block = find_next_fit(heap, size);
             break;
         default:
             return NULL; 
@@ -119,8 +159,8 @@ void *umalloc(size_t size) {
     return ((char *)block + BLOCK_SIZE);
 }
 
-static BlockHeader *find_best_fit(size_t size) {
-    BlockHeader *current = heap_list;
+static BlockHeader *find_best_fit(UHeap *heap, size_t size) {
+    BlockHeader *current = heap->heap_list;
     BlockHeader *best_fit = NULL;
 
     // Find the best fit
@@ -137,8 +177,8 @@ static BlockHeader *find_best_fit(size_t size) {
     return best_fit; //NULL if no suitable block is found
 }
 
-static BlockHeader *find_worst_fit(size_t size) {
-    BlockHeader *current = heap_list;
+static BlockHeader *find_worst_fit(UHeap *heap, size_t size) {
+    BlockHeader *current = heap->heap_list;
     BlockHeader *worst_fit = NULL;
 
     // Find the worst fit
@@ -156,8 +196,8 @@ static BlockHeader *find_worst_fit(size_t size) {
 }
 
 
-static BlockHeader *find_first_fit(size_t size) {
-    BlockHeader *current = heap_list;
+static BlockHeader *find_first_fit(UHeap *heap, size_t size) {
+    BlockHeader *current = heap->heap_list;
 
     //Find the first fit
     while (current != NULL) {
@@ -171,22 +211,22 @@ static BlockHeader *find_first_fit(size_t size) {
 }
 
 
-static BlockHeader *find_next_fit(size_t size) {
-    static BlockHeader *next = NULL;  
-    BlockHeader *start = next;        
-    
-    if (next == NULL) {
-        next = heap_list;
+static BlockHeader *find_next_fit(UHeap *heap, size_t size) {
+    if (heap->next_fit_ptr == NULL) {
+        heap->next_fit_ptr = heap->heap_list;
     }
-    
-    while (next != NULL) {
+
+    // Resume where the previous search stopped, wrapping around once
+    BlockHeader *start = heap->next_fit_ptr;
+    BlockHeader *next = start;
+    do {
         if (next->free && next->size >= size) {
+            heap->next_fit_ptr = next;
             return next; 
         }
         next = next->next;
-        if (next == NULL) next = heap_list;
-        if (next == start) break;
-    }
+        if (next == NULL) next = heap->heap_list;
+    } while (next != start);
 
     return NULL; 
 }
@@ -214,32 +254,42 @@ static void split_block(BlockHeader *block, size_t size) {
 
 
 int ufree(void *ptr) {
-    if (ptr == NULL || ptr < (void *)heap_list || ptr >= (void *)heap_list + sizeof(fake_heap)) {
+    return uheap_free(&default_heap, ptr);
+}
+
+int uheap_free(UHeap *heap, void *ptr) {
+    if (heap == NULL || ptr == NULL || ptr < (void *)heap->heap_list ||
+        ptr >= (void *)((char *)heap->memory_region + heap->size_of_region)) {
         return -1; 
     }
 
     BlockHeader *block = (BlockHeader *)((char *)ptr - BLOCK_SIZE);
     block->free = 1;
     
-    coalesce(block);
+    coalesce(heap, block);
 
     return 0; 
 }
 
-static BlockHeader *coalesce(BlockHeader *block) {
-    // if possible, Coalesce with next block
+static BlockHeader *coalesce(UHeap *heap, BlockHeader *block) {
+    // if possible, Coalesce with next block; next fit must not be left
+    // pointing at a header that was merged away
     if (block->next && block->next->free) {
+        if (heap->next_fit_ptr == block->next)
+            heap->next_fit_ptr = block;
         block->size += sizeof(BlockHeader) + block->next->size;
         block->next = block->next->next;
     }
 
     BlockHeader *prev = NULL;
-    BlockHeader *cur = heap_list;
+    BlockHeader *cur = heap->heap_list;
     while (cur != NULL && cur != block) {
         prev = cur;
         cur = cur->next;
     }
     if (prev && prev->free) {
+        if (heap->next_fit_ptr == block)
+            heap->next_fit_ptr = prev;
         prev->size += sizeof(BlockHeader) + block->size;
         prev->next = block->next;
         block = prev;
@@ -249,7 +299,11 @@ static BlockHeader *coalesce(BlockHeader *block) {
 }
 
 void umemdump() {
-    BlockHeader *current = heap_list;
+    uheap_dump(&default_heap);
+}
+
+void uheap_dump(UHeap *heap) {
+    BlockHeader *current = heap->heap_list;
     while (current != NULL) {
         printf("Block %p: size %zu, free %d\n", (void *)current, current->size, current->free);
         current = current->next;
@@ -14,4 +14,15 @@ void *umalloc(size_t size);
 int ufree(void *ptr);
 void umemdump();
 
+// Private heaps: the same allocator, independent of the global heap above.
+// A heap is not thread safe; give each thread its own.
+typedef struct UHeap UHeap;
+
+UHeap *uheap_create(size_t sizeOfRegion, int allocationAlgo);
+void *uheap_malloc(UHeap *heap, size_t size);
+int uheap_free(UHeap *heap, void *ptr);
+void uheap_reset(UHeap *heap); // Frees every block at once
+void uheap_destroy(UHeap *heap);
+void uheap_dump(UHeap *heap);
+
 #endif
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+// Throughput benchmark for wcat.
+//
+// Writes one large input file, then runs wcat and a reference cat on it
+// with stdout going to a regular file, to a pipe that another process
+// drains, and to /dev/null, and reports GB/s for each. The input is read
+// once beforehand so every run starts from a warm page cache.
+//
+// With -n, the input is instead that many small files, and wcat runs both
+// with its reader threads (-j) and without (-j 0). -C drops the page cache
+// before every run (root only) to measure cold files.
+//
+// Build: gcc -O2 wcat_bench.c -o wcat_bench
+
+#define DRAIN_BUFFER (1024 * 1024)
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define MAX_PROGRAM_ARGS 4
+
+// A command to run on the inputs, e.g. { "./wcat", "-j", "0" }
+typedef struct {
+    const char *label;
+    char *args[MAX_PROGRAM_ARGS];
+} Program;
+
+char **inputs;
+int input_count;
+int drop_caches = 0;
+
+static void make_input(const char *path, long long bytes) {
+    int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    if (fd == -1) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    // Mixed text and binary, NULs included
+    char *block = malloc(DRAIN_BUFFER);
+    unsigned int seed = 12345;
+    for (int i = 0; i < DRAIN_BUFFER; i++) {
+        seed = seed * 1103515245 + 12345;
+        block[i] = (i % 64 == 63) ? '\n' : (char)(seed >> 16);
+    }
+    for (long long done = 0; done < bytes; ) {
+        size_t n = bytes - done < DRAIN_BUFFER ? bytes - done : DRAIN_BUFFER;
+        if (write(fd, block, n) != (ssize_t)n) {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+        done += n;
+    }
+    free(block);
+    close(fd);
+}
+
+// Reads fd to EOF and throws the data away
+static void drain(int fd) {
+    char *buffer = malloc(DRAIN_BUFFER);
+    while (read(fd, buffer, DRAIN_BUFFER) > 0)
+        ;
+    free(buffer);
+}
+
+static void drop_page_cache(void) {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd == -1 || write(fd, "3", 1) != 1) {
+        perror("drop_caches");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+}
+
+// Runs the program on every input with stdout sent to target ("file",
+// "pipe" or "null"); returns wall seconds, or -1 if the program failed
+static double run_once(Program *program, const char *target, const char *output) {
+    if (drop_caches)
+        drop_page_cache();
+
+    char *argv[MAX_PROGRAM_ARGS + input_count + 1];
+    int argc = 0;
+    for (int i = 0; program->args[i] != NULL; i++)
+        argv[argc++] = program->args[i];
+    for (int i = 0; i < input_count; i++)
+        argv[argc++] = inputs[i];
+    argv[argc] = NULL;
+
+    int pipefd[2] = { -1, -1 };
+    pid_t drainer = -1;
+    if (strcmp(target, "pipe") == 0) {
+        if (pipe(pipefd) == -1) {
+            perror("pipe");
+            exit(EXIT_FAILURE);
+        }
+        drainer = fork();
+        if (drainer == 0) {
+            close(pipefd[1]);
+            drain(pipefd[0]);
+            _exit(0);
+        }
+        close(pipefd[0]);
+    }
+
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    } else if (pid == 0) {
+        int fd;
+        if (pipefd[1] != -1)
+            fd = pipefd[1];
+        else if (strcmp(target, "file") == 0)
+            fd = open(output, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+        else
+            fd = open("/dev/null", O_WRONLY);
+        if (fd == -1) {
+            perror(target);
+            _exit(127);
+        }
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    if (pipefd[1] != -1)
+        close(pipefd[1]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (drainer > 0)
+        waitpid(drainer, NULL, 0);
+    double elapsed = now_seconds() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return elapsed;
+}
+
+static void report(Program *program, const char *target, const char *output,
+                   long long bytes, int reps) {
+    double best = -1;
+    for (int rep = 0; rep < reps; rep++) {
+        double elapsed = run_once(program, target, output);
+        if (elapsed < 0) {
+            fprintf(stderr, "%s failed writing to %s\n", program->label, target);
+            exit(EXIT_FAILURE);
+        }
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    printf("%-20s %-5s %10.3f GB %10.3f s %8.2f GB/s\n",
+           program->label, target, bytes / 1e9, best, bytes / 1e9 / best);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-w wcat] [-c cat] [-m megabytes] [-n files -k kilobytes] [-j readers] [-C] [-r reps] [-d dir]\n"
+            "  -w  path to the wcat binary (default ./wcat)\n"
+            "  -c  reference cat (default /bin/cat)\n"
+            "  -m  input size in MB (default 2048)\n"
+            "  -n  use this many small input files instead of one large one\n"
+            "  -k  size of each small file in KB (default 64)\n"
+            "  -j  wcat reader threads in the -n runs (default 4)\n"
+            "  -C  drop the page cache before every run (needs root)\n"
+            "  -r  repetitions, best time is kept (default 3)\n"
+            "  -d  directory for the input and output files (default /tmp)\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    const char *wcat = "./wcat";
+    const char *cat = "/bin/cat";
+    const char *dir = "/tmp";
+    long long megabytes = 2048;
+    long long kilobytes = 64;
+    int files = 0;
+    char *readers = "4";
+    int reps = 3;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:c:m:n:k:j:Cr:d:")) != -1) {
+        switch (opt) {
+            case 'w': wcat = optarg; break;
+            case 'c': cat = optarg; break;
+            case 'm': megabytes = atoll(optarg); break;
+            case 'n': files = atoi(optarg); break;
+            case 'k': kilobytes = atoll(optarg); break;
+            case 'j': readers = optarg; break;
+            case 'C': drop_caches = 1; break;
+            case 'r': reps = atoi(optarg); break;
+            case 'd': dir = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (megabytes < 1 || kilobytes < 1 || files < 0 || reps < 1)
+        usage(argv[0]);
+
+    char output[4096];
+    snprintf(output, sizeof(output), "%s/wcat_bench.%d.out", dir, (int)getpid());
+    long long bytes;
+    input_count = files > 0 ? files : 1;
+    inputs = malloc(sizeof(char *) * input_count);
+    for (int i = 0; i < input_count; i++) {
+        inputs[i] = malloc(4096);
+        snprintf(inputs[i], 4096, "%s/wcat_bench.%d.in%d", dir, (int)getpid(), i);
+    }
+    if (files > 0) {
+        bytes = kilobytes * 1024 * files;
+        for (int i = 0; i < files; i++)
+            make_input(inputs[i], kilobytes * 1024);
+    } else {
+        bytes = megabytes * 1024 * 1024;
+        make_input(inputs[0], bytes);
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "wcat -j %s", readers);
+    Program programs[] = {
+        { "wcat", { (char *)wcat, NULL } },
+        { "wcat -j 0", { (char *)wcat, "-j", "0", NULL } },
+        { label, { (char *)wcat, "-j", readers, NULL } },
+        { cat, { (char *)cat, NULL } },
+    };
+    Program *selected[3];
+    int program_count = 0;
+    if (files > 0) {
+        selected[program_count++] = &programs[1];
+        selected[program_count++] = &programs[2];
+    } else {
+        selected[program_count++] = &programs[0];
+    }
+    selected[program_count++] = &programs[3];
+
+    run_once(&programs[3], "null", output);
+    const char *targets[] = { "file", "pipe", "null" };
+    for (int t = 0; t < 3; t++) {
+        for (int p = 0; p < program_count; p++)
+            report(selected[p], targets[t], output, bytes, reps);
+    }
+
+    for (int i = 0; i < input_count; i++) {
+        unlink(inputs[i]);
+        free(inputs[i]);
+    }
+    free(inputs);
+    unlink(output);
+    return 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,44 +7,227 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
 #include <ctype.h>
+#include <spawn.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include "wish_lex.h"
+#include "fastcopy.h"
 
-#define MAX_BACKGROUND_PROCESSES 50 
-#define MAX_LINE 512   
-#define MAX_ARGS 10    
+extern char **environ;
 
-pid_t background_pids[MAX_BACKGROUND_PROCESSES];
-int background_pid_count = 0;
+#define COMMAND_TABLE_SIZE 256
+#define PATH_RECHECK_SECONDS 1.0
 
+// Search path set by the path builtin; with no directories, commands are
+// run exactly as typed
+char *default_path[] = { "/bin" };
+char **path = default_path;
+int path_count = 1;
 
-char* path = "/bin";
+// Resolved executables by command name. An entry with no resolved path
+// records that the command was not found. The table is dropped when path
+// changes or when one of the directories' mtimes does (checked at most
+// every PATH_RECHECK_SECONDS), so repeated commands cost no syscalls.
+typedef struct CommandEntry {
+    char *name;
+    char *resolved;
+    struct CommandEntry *next;
+} CommandEntry;
+
+CommandEntry *command_table[COMMAND_TABLE_SIZE];
+struct timespec *path_mtimes = NULL; // NULL until the next check records them
+double path_checked_at = 0;
 int global_last_command_status = 0; 
+int pipe_size = 0; // From WISH_PIPE_SIZE; 0 keeps the kernel default
+int fast_builtins = 0; // From WISH_FAST_BUILTINS; run cat and wcat in-process
+
+// Children that have not been reaped yet, grouped by command line: every
+// background job, and in -j mode every running batch line
+typedef struct {
+    int id;
+    pid_t *pids;
+    int num_pids;
+    int remaining;   // Stages not reaped yet
+    int status;      // Exit status of the last stage
+    int background;
+    char *command;
+    int profile;     // Index into profile_entries, or -1
+} Job;
+
+Job *jobs = NULL;
+int job_count = 0;
+int job_capacity = 0;
+int next_job_id = 1;
+
+// Children reaped by the SIGCHLD handler, with the time they were reaped,
+// waiting to be recorded against their jobs. Only the handler appends; the
+// rest of the shell reads it with SIGCHLD blocked.
+typedef struct {
+    pid_t pid;
+    int status;
+    struct rusage usage;
+    double exit_time;
+} ReapedChild;
+
+#define REAPED_CAPACITY 256
+ReapedChild reaped[REAPED_CAPACITY];
+volatile sig_atomic_t reaped_count = 0;
+volatile sig_atomic_t child_exited = 0; // The handler ran out of room
+
+// wish -j N: batch lines run without waiting, up to N at a time
+int parallel_limit = 0; // 0 outside -j mode
+int parallel_count = 0; // Running jobs started by -j mode
+int any_command_failed = 0;
+
+// Token and argv storage, reused from one command line to the next
+Lexer lexer;
+
+// One measured command line: every line under --profile, and each line
+// run with the time builtin
+typedef struct {
+    int line;
+    char *command;
+    double start;
+    double wall_seconds;
+    double spawn_seconds;  // Until the last stage was spawned
+    double user_seconds;   // Summed over all stages
+    double sys_seconds;
+    long max_rss_kb;       // Largest of any stage
+    int status;
+    int timed;             // Print the result as soon as it finishes
+} ProfileEntry;
+
+ProfileEntry *profile_entries = NULL;
+int profile_count = 0;
+int profile_capacity = 0;
+int profile_enabled = 0;
+char *profile_file = NULL; // JSON goes here; NULL prints a table to stderr
+int current_line = 0;
 
 // Function Declarations
-void execute_command(char *args[], int redirect, char *output_file, int background, int batch_mode);
+int resolve_command(char *cmd, char *command, size_t size);
+void forget_command(char *cmd);
+void clear_command_table();
+void execute_command(char *args[], int redirect, char *output_file, int background, int batch_mode, int timed);
+void execute_pipeline(char **stages[], int num_stages, int redirect, char *output_file, int background, int batch_mode, int timed);
 void builtin_cd(char *args[]);
+void builtin_error();
 void builtin_path(char *args[]);
 int is_builtin_command(char *cmd);
 void parse_and_execute(char *line, int batch_mode);
 void wait_for_background_processes();
+Job *add_job(pid_t pids[], int num_pids, int background, char **stages[], int num_stages, int profile);
+static void record_child(pid_t pid, int status, struct rusage *usage, double exit_time);
+void reap_children(int options);
+void reap_finished_jobs(int batch_mode);
+void wait_for_parallel_jobs(int max_running);
+void builtin_jobs(char *args[]);
+void builtin_wait(char *args[]);
+char *join_command(char **stages[], int num_stages);
+int start_profile(char **stages[], int num_stages, int timed);
+void add_profile_usage(int profile, struct rusage *usage);
+void finish_profile(int profile, int status, double end);
+void report_profile();
+int run_fast_builtin(char *args[], int redirect, char *output_file);
+
+// Reaps right away, so a background or -j line's wall time ends when it
+// exits rather than whenever the shell next looks
+static void handle_sigchld(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    while (reaped_count < REAPED_CAPACITY) {
+        ReapedChild *child = &reaped[reaped_count];
+        child->pid = wait4(-1, &child->status, WNOHANG, &child->usage);
+        if (child->pid <= 0) {
+            break;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        child->exit_time = ts.tv_sec + ts.tv_nsec / 1e9;
+        reaped_count++;
+    }
+    if (reaped_count == REAPED_CAPACITY) {
+        child_exited = 1;
+    }
+    errno = saved_errno;
+}
 
 int main(int argc, char *argv[]) {
     char *line = NULL;
     size_t len = 0;
     ssize_t nread;
     
-    int batch_mode = (argc == 2) ? 1 : 0;  // 1 for batch mode, 0 for interactive
+    int batch_mode = 0;  // 1 for batch mode, 0 for interactive
+    char *script = NULL;
 
-    if (argc == 1) {  
+    // wish [-j N] [--profile[=file]] [script]
+    //   -j N runs independent batch lines concurrently
+    //   --profile measures every command line and reports at exit
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0) {
+            char *end = NULL;
+            long value = (i + 1 < argc) ? strtol(argv[++i], &end, 10) : 0;
+            if (end == NULL || end == argv[i] || *end != '\0' || value < 1 || value > INT_MAX) {
+                fprintf(stderr, "An error has occurred\n");
+                exit(1);
+            }
+            parallel_limit = (int) value;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile_enabled = 1;
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profile_enabled = 1;
+            profile_file = argv[i] + 10;
+        } else if (script == NULL) {
+            script = argv[i];
+            batch_mode = 1;
+        } else {
+            fprintf(stderr, "An error has occurred\n");
+            exit(1);
+        }
+    }
+    if (parallel_limit > 0 && !batch_mode) {
+        fprintf(stderr, "An error has occurred\n");
+        exit(1);
+    }
+    if (profile_enabled) {
+        atexit(report_profile);
+    }
+
+    // The handler reaps exited children; they are recorded against their
+    // jobs before the next command line
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sigchld;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    // Larger pipe buffers let pipeline stages run further ahead of each other
+    char *pipe_size_env = getenv("WISH_PIPE_SIZE");
+    if (pipe_size_env != NULL) {
+        pipe_size = atoi(pipe_size_env);
+    }
+    char *fast_builtins_env = getenv("WISH_FAST_BUILTINS");
+    if (fast_builtins_env != NULL) {
+        fast_builtins = atoi(fast_builtins_env);
+    }
+
+    if (!batch_mode) {  
         while (1) {
+            reap_finished_jobs(batch_mode);
             printf("wish> ");
             if ((nread = getline(&line, &len, stdin)) == -1)
                 break;  
+            current_line++;
             parse_and_execute(line, batch_mode);
         }
-    } else if (argc == 2) {  
+    } else {  
         //printf("Running in batch mode\n"); // Debug print
-        FILE *file = fopen(argv[1], "r");
+        FILE *file = fopen(script, "r");
         if (!file) {
             fprintf(stderr, "An error has occurred\n");
             exit(1);
@@ -52,17 +236,28 @@ int main(int argc, char *argv[]) {
         len = 0;
         while ((nread = getline(&line, &len, file)) != -1) {
             //printf("Batch mode: 1, Command: %s", line);  // Debug print (including line break in 'line')
+            current_line++;
+            reap_finished_jobs(batch_mode);
+            // In -j mode each line's own failures (a command that could
+            // not start, a builtin error) count towards the exit status
+            if (parallel_limit > 0) {
+                global_last_command_status = 0;
+            }
             parse_and_execute(line, batch_mode);
+            if (parallel_limit > 0 && global_last_command_status != 0) {
+                any_command_failed = 1;
+            }
             free(line); 
             line = NULL; 
         }
         free(line);
         fclose(file);
+        wait_for_parallel_jobs(0);
         wait_for_background_processes();
+        if (parallel_limit > 0) {
+            exit(any_command_failed ? 1 : 0);
+        }
         exit(global_last_command_status);
-    } else {
-        fprintf(stderr, "An error has occurred\n");
-        exit(1);
     }
 
     free(line);
@@ -70,181 +265,852 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
-void trim(char *str) {
-    char *end;
-
-    while (isspace((unsigned char)*str)) str++;
-    
-    if (*str == 0) {
-        return;
-    }
-
-    end = str + strlen(str) - 1;
-    while (end > str && isspace((unsigned char)*end)) end--;
-
-
-    end[1] = '\0';
-}
-
 void parse_and_execute(char *line, int batch_mode) {
     //printf("Batch mode: %d, Command: %s\n", batch_mode, line); // Debug print
-    char *args[MAX_ARGS];
-    int argc = 0;
     int redirect = 0;
     char *output_file = NULL;
     int background = 0;
 
-    trim(line);
+    if (lex_line(&lexer, line) != 0) {
+        builtin_error();
+        return;
+    }
+    Token *tokens = lexer.tokens;
+    int count = lexer.count;
 
-    if (strcmp(line, "&") == 0) {
+    if (count == 1 && tokens[0].type == TOKEN_BACKGROUND) {
         return;
     }
 
-    char *redirect_pos = strchr(line, '>');
-    if (redirect_pos != NULL) {
-        *redirect_pos = '\0';   
+    // A trailing & applies to the whole pipeline, redirection included
+    if (count > 0 && tokens[count - 1].type == TOKEN_BACKGROUND) {
+        background = 1;
+        count--;
+    }
+
+    // The redirection can only follow the last stage: > and one file name
+    if (count >= 2 && tokens[count - 2].type == TOKEN_REDIRECT && tokens[count - 1].type == TOKEN_WORD) {
         redirect = 1;
-        output_file = strtok(redirect_pos + 1, " \t\n");  
-        if (output_file == NULL || strtok(NULL, " \t\n") != NULL) {
-            write(STDERR_FILENO, "An error has occurred\n", strlen("An error has occurred\n"));
+        output_file = tokens[count - 1].text;
+        count -= 2;
+    }
+
+    // Lay the stages out in the lexer's argv, each followed by a NULL
+    int num_stages = 1;
+    for (int i = 0; i < count; i++) {
+        if (tokens[i].type == TOKEN_PIPE) {
+            num_stages++;
+        } else if (tokens[i].type != TOKEN_WORD) {
+            builtin_error();
             return;
         }
     }
-
-    char *token = strtok(line, " \t\n");
-    while (token != NULL) {
-        args[argc++] = token;
-        token = strtok(NULL, " \t\n");
+    char **stages[num_stages];
+    char **argv = lexer.argv;
+    int stage = 0;
+    int n = 0;
+    stages[0] = argv;
+    for (int i = 0; i < count; i++) {
+        if (tokens[i].type == TOKEN_WORD) {
+            argv[n++] = tokens[i].text;
+            continue;
+        }
+        if (&argv[n] == stages[stage]) {
+            builtin_error();
+            return;
+        }
+        argv[n++] = NULL;
+        stages[++stage] = &argv[n];
     }
-    // Check for background command
-    if (argc > 0 && strcmp(args[argc - 1], "&") == 0) {
-        background = 1;
-        args[--argc] = NULL; 
+    argv[n] = NULL;
+    if (num_stages > 1 && stages[stage][0] == NULL) {
+        builtin_error();
+        return;
     }
 
-    args[argc] = NULL;
-
-  
-    if (argc == 1 && strcmp(args[0], "&") == 0) {
-        return;
+    // time runs the rest of the line as usual and reports on it when it
+    // finishes; it cannot time a builtin
+    int timed = 0;
+    if (stages[0][0] != NULL && strcmp(stages[0][0], "time") == 0) {
+        timed = 1;
+        stages[0]++;
+        if (stages[0][0] == NULL || is_builtin_command(stages[0][0])) {
+            builtin_error();
+            return;
+        }
     }
+    char **args = stages[0];
 
-  
-    if (argc == 0) {
+    if (args[0] == NULL) {
         if (redirect) {
-            write(STDERR_FILENO, "An error has occurred\n", strlen("An error has occurred\n"));
+            builtin_error();
         }
         return;  
     } 
 
-    if (is_builtin_command(args[0])) {
+    if (num_stages > 1) {
+        // Builtins change the shell itself and cannot run as a stage
+        for (int i = 0; i < num_stages; i++) {
+            if (is_builtin_command(stages[i][0])) {
+                builtin_error();
+                return;
+            }
+        }
+        execute_pipeline(stages, num_stages, redirect, output_file, background, batch_mode, timed);
+    } else if (is_builtin_command(args[0])) {
+        // Builtins change shell state, so in -j mode they are barriers
+        wait_for_parallel_jobs(0);
         if (strcmp(args[0], "exit") == 0) {
             if (args[1] != NULL) {
-                write(STDERR_FILENO, "An error has occurred\n", strlen("An error has occurred\n"));
+                builtin_error();
             } else {
                 wait_for_background_processes();
-                exit(0);
+                exit((parallel_limit > 0 && any_command_failed) ? 1 : 0);
             }
         } else if (strcmp(args[0], "cd") == 0) {
             builtin_cd(args);
         } else if (strcmp(args[0], "path") == 0) {
             builtin_path(args);
+        } else if (strcmp(args[0], "jobs") == 0) {
+            reap_finished_jobs(batch_mode);
+            builtin_jobs(args);
+        } else if (strcmp(args[0], "wait") == 0) {
+            builtin_wait(args);
         }
     } else {
-        execute_command(args, redirect, output_file, background, batch_mode);
+        execute_command(args, redirect, output_file, background, batch_mode, timed);
     }
 }
 
-void execute_command(char *args[], int redirect, char *output_file, int background, int batch_mode) {
-    int rc = fork();
-    if (rc < 0) {
-        perror("fork");
-        exit(1);
-    } else if (rc == 0) {  
-        if (redirect) {
-            int fd = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, S_IRWXU);
-            if (fd == -1) {
-                perror("open");
-                exit(1);
+static double monotonic_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int hash_command(const char *name) {
+    unsigned int h = 5381;
+    while (*name) {
+        h = h * 33 + (unsigned char)*name++;
+    }
+    return h % COMMAND_TABLE_SIZE;
+}
+
+void clear_command_table() {
+    for (int i = 0; i < COMMAND_TABLE_SIZE; i++) {
+        CommandEntry *entry = command_table[i];
+        while (entry != NULL) {
+            CommandEntry *next = entry->next;
+            free(entry->name);
+            free(entry->resolved);
+            free(entry);
+            entry = next;
+        }
+        command_table[i] = NULL;
+    }
+}
+
+void forget_command(char *cmd) {
+    CommandEntry **link = &command_table[hash_command(cmd)];
+    while (*link != NULL) {
+        CommandEntry *entry = *link;
+        if (strcmp(entry->name, cmd) == 0) {
+            *link = entry->next;
+            free(entry->name);
+            free(entry->resolved);
+            free(entry);
+            return;
+        }
+        link = &entry->next;
+    }
+}
+
+// Drops the table if a search directory was modified since it was filled
+static void check_path_mtimes() {
+    double now = monotonic_seconds();
+    if (path_mtimes != NULL && now - path_checked_at < PATH_RECHECK_SECONDS) {
+        return;
+    }
+    path_checked_at = now;
+
+    int changed = (path_mtimes == NULL);
+    if (path_mtimes == NULL) {
+        path_mtimes = calloc(path_count, sizeof(struct timespec));
+    }
+    for (int i = 0; i < path_count; i++) {
+        struct stat sb;
+        struct timespec mtime = {0, 0};
+        if (stat(path[i], &sb) == 0) {
+            mtime = sb.st_mtim;
+        }
+        if (mtime.tv_sec != path_mtimes[i].tv_sec || mtime.tv_nsec != path_mtimes[i].tv_nsec) {
+            path_mtimes[i] = mtime;
+            changed = 1;
+        }
+    }
+    if (changed) {
+        clear_command_table();
+    }
+}
+
+// Finds the executable for cmd in the parent, so the child only has to exec
+int resolve_command(char *cmd, char *command, size_t size) {
+    int n;
+    if (path_count == 0) {
+        n = snprintf(command, size, "%s", cmd);
+        if (n < 0 || (size_t)n >= size) {
+            return -1;
+        }
+        return access(command, X_OK);
+    }
+
+    check_path_mtimes();
+
+    unsigned int bucket = hash_command(cmd);
+    CommandEntry *entry = command_table[bucket];
+    while (entry != NULL && strcmp(entry->name, cmd) != 0) {
+        entry = entry->next;
+    }
+
+    if (entry == NULL) {
+        entry = malloc(sizeof(CommandEntry));
+        entry->name = strdup(cmd);
+        entry->resolved = NULL;
+        for (int i = 0; i < path_count; i++) {
+            n = snprintf(command, size, "%s/%s", path[i], cmd);
+            if (n >= 0 && (size_t)n < size && access(command, X_OK) == 0) {
+                entry->resolved = strdup(command);
+                break;
             }
-            if (dup2(fd, STDOUT_FILENO) == -1) {
-                perror("dup2");
-                close(fd);
-                exit(1);
+        }
+        entry->next = command_table[bucket];
+        command_table[bucket] = entry;
+    }
+
+    if (entry->resolved == NULL) {
+        return -1;
+    }
+    n = snprintf(command, size, "%s", entry->resolved);
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+static void free_pipeline(char **commands, pid_t *pids, int num_stages) {
+    for (int i = 0; i < num_stages; i++) {
+        free(commands[i]);
+    }
+    free(commands);
+    free(pids);
+}
+
+void execute_command(char *args[], int redirect, char *output_file, int background, int batch_mode, int timed) {
+    execute_pipeline(&args, 1, redirect, output_file, background, batch_mode, timed);
+}
+
+// Spawns every stage at once, each reading the previous stage's pipe. The
+// pipes are O_CLOEXEC so a child keeps only the ends dup2'd onto its
+// stdin/stdout. The pipeline's status is that of its last stage. A timed
+// pipeline is always waited for, even in -j mode.
+void execute_pipeline(char **stages[], int num_stages, int redirect, char *output_file, int background, int batch_mode, int timed) {
+    if (fast_builtins && num_stages == 1 && !background && !timed &&
+        run_fast_builtin(stages[0], redirect, output_file) == 0) {
+        return;
+    }
+
+    // The resolved paths and pids live on the heap, since a line may have
+    // any number of stages
+    char **commands = calloc(num_stages, sizeof(char *));
+    pid_t *pids = malloc(sizeof(pid_t) * num_stages);
+    if (commands == NULL || pids == NULL) {
+        fprintf(stderr, "An error has occurred\n");
+        global_last_command_status = 1;
+        free(commands);
+        free(pids);
+        return;
+    }
+    char command[PATH_MAX];
+    for (int i = 0; i < num_stages; i++) {
+        if (resolve_command(stages[i][0], command, sizeof(command)) == -1 ||
+            (commands[i] = strdup(command)) == NULL) {
+            fprintf(stderr, "An error has occurred\n");
+            global_last_command_status = 1;
+            free_pipeline(commands, pids, num_stages);
+            return;
+        }
+    }
+
+    // Wait for a free slot before spawning, so at most N jobs are running and
+    // no child of this line can be reaped before its job is recorded
+    int parallel = (!background && parallel_limit > 0 && !timed);
+    if (parallel) {
+        wait_for_parallel_jobs(parallel_limit - 1);
+    }
+
+    // Until this line's children are waited for or recorded as a job, the
+    // SIGCHLD handler must not reap them. They start with the shell's
+    // usual mask.
+    sigset_t block, saved_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &saved_mask);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &saved_mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    int profile = (profile_enabled || timed) ? start_profile(stages, num_stages, timed) : -1;
+    int spawned = 0;
+    int prev_read = -1;
+    for (int i = 0; i < num_stages; i++) {
+        int pipefd[2] = { -1, -1 };
+        if (i < num_stages - 1) {
+            if (pipe2(pipefd, O_CLOEXEC) == -1) {
+                fprintf(stderr, "An error has occurred\n");
+                break;
+            }
+            if (pipe_size > 0) {
+                fcntl(pipefd[1], F_SETPIPE_SZ, pipe_size);
             }
-            
-            close(fd);  
         }
 
-        char command[256];
-        if (path != NULL) {
-            sprintf(command, "%s/%s", path, args[0]); 
-        } else {
-            strcpy(command, args[0]);  
+        // posix_spawn creates the child with vfork semantics (no page table
+        // copy), and the redirections are done by its file actions
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        if (prev_read != -1) {
+            posix_spawn_file_actions_adddup2(&actions, prev_read, STDIN_FILENO);
+        }
+        if (pipefd[1] != -1) {
+            posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+        } else if (redirect) {
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, output_file,
+                                             O_CREAT | O_WRONLY | O_TRUNC, S_IRWXU);
+        }
+
+        int err = posix_spawn(&pids[spawned], commands[i], &actions, &attr, stages[i], environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if (err == ENOENT || err == EACCES || err == ENOEXEC) {
+            // The cached location went stale; look it up again next time
+            forget_command(stages[i][0]);
         }
 
-        if (access(command, X_OK) == -1) {
+        if (prev_read != -1) {
+            close(prev_read);
+        }
+        if (pipefd[1] != -1) {
+            close(pipefd[1]);
+        }
+        prev_read = pipefd[0];
+
+        if (err != 0) {
             fprintf(stderr, "An error has occurred\n");
-            global_last_command_status = 1;
-            exit(1);  
+            break;
         }
+        spawned++;
+    }
+    if (prev_read != -1) {
+        close(prev_read);
+    }
+    posix_spawnattr_destroy(&attr);
+    if (profile != -1) {
+        ProfileEntry *entry = &profile_entries[profile];
+        entry->spawn_seconds = monotonic_seconds() - entry->start;
+    }
 
-        execv(command, args);
-        fprintf(stderr, "An error has occurred\n");
+    if (spawned < num_stages) {
+        // Reap whatever started; the earlier stages see EOF or EPIPE
         global_last_command_status = 1;
-        exit(1);  
+        for (int i = 0; i < spawned; i++) {
+            waitpid(pids[i], NULL, 0);
+        }
+        sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+        finish_profile(profile, 1, monotonic_seconds());
+        free_pipeline(commands, pids, num_stages);
+        return;
+    }
 
-    } else {  
-        if (!background) {
+    if (parallel) {
+        add_job(pids, num_stages, 0, stages, num_stages, profile);
+        parallel_count++;
+    } else if (!background) {
+        // Any child may exit meanwhile; background and -j ones are recorded
+        // as they go, so their times are not held up by this line
+        int remaining = num_stages;
+        while (remaining > 0) {
             int status;
-            waitpid(rc, &status, 0);  
-
-            if (WIFEXITED(status)) {
-                global_last_command_status = WEXITSTATUS(status);
+            struct rusage usage;
+            pid_t pid = wait4(-1, &status, 0, &usage);
+            if (pid == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
             }
-        } else {
-            if (background_pid_count < MAX_BACKGROUND_PROCESSES) {
-                background_pids[background_pid_count++] = rc; 
-            } else {
-                // Handle error
+            int i = 0;
+            while (i < num_stages && pids[i] != pid) {
+                i++;
             }
-            if (!batch_mode) {
-                printf("Background process %d started.\n", rc);
+            if (i == num_stages) {
+                record_child(pid, status, &usage, monotonic_seconds());
+                continue;
             }
+            add_profile_usage(profile, &usage);
+            if (i == num_stages - 1 && WIFEXITED(status)) {
+                global_last_command_status = WEXITSTATUS(status);
+            }
+            remaining--;
+        }
+        finish_profile(profile, global_last_command_status, monotonic_seconds());
+    } else {
+        Job *job = add_job(pids, num_stages, 1, stages, num_stages, profile);
+        if (!batch_mode) {
+            // The job id is what wait <id> takes
+            printf("[%d] Background process %d started.\n", job->id, pids[num_stages - 1]);
+            fflush(stdout);
         }
     }
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+    free_pipeline(commands, pids, num_stages);
 }
 
 
+// Reports a misused builtin or a line that does not parse. In -j mode the
+// line then counts as failed, like a command that exits non-zero.
+void builtin_error() {
+    write(STDERR_FILENO, "An error has occurred\n", strlen("An error has occurred\n"));
+    if (parallel_limit > 0) {
+        global_last_command_status = 1;
+    }
+}
+
 void builtin_cd(char *args[]) {
     if (args[1] == NULL || args[2] != NULL) {
-        write(STDERR_FILENO, "An error has occurred\n", strlen("An error has occurred\n"));
+        builtin_error();
         return;
     }
     if (chdir(args[1]) != 0) {
-        write(STDERR_FILENO, "An error has occurred\n", strlen("An error has occurred\n"));
+        builtin_error();
+        return;
+    }
+    // Relative search directories now point somewhere else
+    for (int i = 0; i < path_count; i++) {
+        if (path[i][0] != '/') {
+            free(path_mtimes);
+            path_mtimes = NULL;
+            break;
+        }
     }
 }
 
 void builtin_path(char *args[]) {
-    if (args[1] == NULL) {
-        //free(path);
-        path = NULL;
-    } else {
-        //free(path);
-        path = strdup(args[1]);
+    if (path != default_path) {
+        for (int i = 0; i < path_count; i++) {
+            free(path[i]);
+        }
+        free(path);
     }
+
+    path_count = 0;
+    while (args[path_count + 1] != NULL) {
+        path_count++;
+    }
+    path = malloc(sizeof(char *) * (path_count + 1));
+    for (int i = 0; i < path_count; i++) {
+        path[i] = strdup(args[i + 1]);
+    }
+
+    free(path_mtimes);
+    path_mtimes = NULL;
+    clear_command_table();
 }
 
 int is_builtin_command(char *cmd) {
-    return (strcmp(cmd, "exit") == 0 || strcmp(cmd, "cd") == 0 || strcmp(cmd, "path") == 0);
+    return (strcmp(cmd, "exit") == 0 || strcmp(cmd, "cd") == 0 || strcmp(cmd, "path") == 0 ||
+            strcmp(cmd, "jobs") == 0 || strcmp(cmd, "wait") == 0 || strcmp(cmd, "time") == 0);
+}
+
+// The command line as text, stages joined by " | "
+char *join_command(char **stages[], int num_stages) {
+    size_t length = 1;
+    for (int i = 0; i < num_stages; i++) {
+        for (int k = 0; stages[i][k] != NULL; k++) {
+            length += strlen(stages[i][k]) + 3;
+        }
+    }
+    char *command = malloc(length);
+    command[0] = '\0';
+    for (int i = 0; i < num_stages; i++) {
+        if (i > 0) {
+            strcat(command, " |");
+        }
+        for (int k = 0; stages[i][k] != NULL; k++) {
+            if (i > 0 || k > 0) {
+                strcat(command, " ");
+            }
+            strcat(command, stages[i][k]);
+        }
+    }
+    return command;
+}
+
+Job *add_job(pid_t pids[], int num_pids, int background, char **stages[], int num_stages, int profile) {
+    if (job_count == job_capacity) {
+        job_capacity = job_capacity ? job_capacity * 2 : 16;
+        jobs = realloc(jobs, sizeof(Job) * job_capacity);
+    }
+
+    Job *job = &jobs[job_count++];
+    job->id = next_job_id++;
+    job->pids = malloc(sizeof(pid_t) * num_pids);
+    memcpy(job->pids, pids, sizeof(pid_t) * num_pids);
+    job->num_pids = num_pids;
+    job->remaining = num_pids;
+    job->status = 0;
+    job->background = background;
+    job->command = join_command(stages, num_stages);
+    job->profile = profile;
+    return job;
+}
+
+static void remove_job(int index) {
+    free(jobs[index].pids);
+    free(jobs[index].command);
+    memmove(&jobs[index], &jobs[index + 1], sizeof(Job) * (job_count - index - 1));
+    job_count--;
+}
+
+static Job *find_job(int id) {
+    for (int j = 0; j < job_count; j++) {
+        if (jobs[j].id == id) {
+            return &jobs[j];
+        }
+    }
+    return NULL;
+}
+
+// Records one reaped child against its job. A -j job is dropped as soon as
+// it finishes and counts as failed if its last stage did not exit with 0;
+// finished background jobs stay until they are reported or waited for.
+static void record_child(pid_t pid, int status, struct rusage *usage, double exit_time) {
+    for (int j = 0; j < job_count; j++) {
+        Job *job = &jobs[j];
+        int k = 0;
+        while (k < job->num_pids && job->pids[k] != pid) {
+            k++;
+        }
+        if (k == job->num_pids) {
+            continue;
+        }
+
+        if (k == job->num_pids - 1) {
+            job->status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        }
+        add_profile_usage(job->profile, usage);
+        if (--job->remaining == 0) {
+            finish_profile(job->profile, job->status, exit_time);
+        }
+        if (job->remaining == 0 && !job->background) {
+            global_last_command_status = job->status;
+            if (job->status != 0) {
+                any_command_failed = 1;
+            }
+            parallel_count--;
+            remove_job(j);
+        }
+        return;
+    }
+}
+
+// Records the children the SIGCHLD handler reaped, then reaps any others;
+// with options 0 blocks until at least one has been recorded
+void reap_children(int options) {
+    sigset_t block, saved_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &saved_mask);
+
+    if (reaped_count > 0) {
+        options |= WNOHANG;
+    }
+    for (int i = 0; i < reaped_count; i++) {
+        record_child(reaped[i].pid, reaped[i].status, &reaped[i].usage, reaped[i].exit_time);
+    }
+    reaped_count = 0;
+    child_exited = 0;
+
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, options, &usage)) > 0) {
+        record_child(pid, status, &usage, monotonic_seconds());
+        options |= WNOHANG;
+    }
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+}
+
+// Records children reaped by the SIGCHLD handler and drops finished
+// background jobs, telling the user about them in interactive mode
+void reap_finished_jobs(int batch_mode) {
+    if (reaped_count > 0 || child_exited) {
+        reap_children(WNOHANG);
+    }
+    for (int j = 0; j < job_count; j++) {
+        if (jobs[j].background && jobs[j].remaining == 0) {
+            if (!batch_mode) {
+                printf("[%d] Done %s\n", jobs[j].id, jobs[j].command);
+            }
+            remove_job(j--);
+        }
+    }
+    // Children write straight to the same stdout, so don't let this sit
+    // in the buffer behind their output
+    fflush(stdout);
+}
+
+// Reaps children until no more than max_running -j jobs are left
+void wait_for_parallel_jobs(int max_running) {
+    while (parallel_count > max_running) {
+        reap_children(0);
+    }
+}
+
+void builtin_jobs(char *args[]) {
+    if (args[1] != NULL) {
+        builtin_error();
+        return;
+    }
+    for (int j = 0; j < job_count; j++) {
+        if (jobs[j].background) {
+            printf("[%d] Running %s\n", jobs[j].id, jobs[j].command);
+        }
+    }
+    fflush(stdout);
+}
+
+// wait waits for every background job; wait <id> for one, taking its status
+void builtin_wait(char *args[]) {
+    if (args[1] == NULL) {
+        wait_for_background_processes();
+        global_last_command_status = 0;
+        return;
+    }
+
+    char *end;
+    long id = strtol(args[1], &end, 10);
+    Job *job = (*end == '\0' && args[2] == NULL) ? find_job((int)id) : NULL;
+    if (job == NULL || !job->background) {
+        write(STDERR_FILENO, "An error has occurred\n", strlen("An error has occurred\n"));
+        global_last_command_status = 1;
+        return;
+    }
+    while (job->remaining > 0) {
+        reap_children(0);
+        job = find_job((int)id); // The table may have moved
+    }
+    global_last_command_status = job->status;
+    remove_job(job - jobs);
 }
 
 void wait_for_background_processes() {
-    for (int i = 0; i < background_pid_count; i++) {
-        int status;
-        waitpid(background_pids[i], &status, 0);
+    for (int j = 0; j < job_count; j++) {
+        while (jobs[j].background && jobs[j].remaining > 0) {
+            reap_children(0);
+        }
+    }
+    for (int j = 0; j < job_count; j++) {
+        if (jobs[j].background) {
+            remove_job(j--);
+        }
     }
-    background_pid_count = 0; 
 }
 
+int start_profile(char **stages[], int num_stages, int timed) {
+    if (profile_count == profile_capacity) {
+        profile_capacity = profile_capacity ? profile_capacity * 2 : 64;
+        profile_entries = realloc(profile_entries, sizeof(ProfileEntry) * profile_capacity);
+    }
+    ProfileEntry *entry = &profile_entries[profile_count];
+    memset(entry, 0, sizeof(*entry));
+    entry->line = current_line;
+    entry->command = join_command(stages, num_stages);
+    entry->timed = timed;
+    entry->start = monotonic_seconds();
+    return profile_count++;
+}
+
+void add_profile_usage(int profile, struct rusage *usage) {
+    if (profile == -1) {
+        return;
+    }
+    ProfileEntry *entry = &profile_entries[profile];
+    entry->user_seconds += usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6;
+    entry->sys_seconds += usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+    if (usage->ru_maxrss > entry->max_rss_kb) {
+        entry->max_rss_kb = usage->ru_maxrss;
+    }
+}
+
+// end is when the line's last child exited
+void finish_profile(int profile, int status, double end) {
+    if (profile == -1) {
+        return;
+    }
+    ProfileEntry *entry = &profile_entries[profile];
+    entry->wall_seconds = end - entry->start;
+    entry->status = status;
+    if (entry->timed) {
+        fprintf(stderr, "real %.3fs\nuser %.3fs\nsys %.3fs\nmaxrss %ldKB\nspawn %.0fus\nstatus %d\n",
+                entry->wall_seconds, entry->user_seconds, entry->sys_seconds,
+                entry->max_rss_kb, entry->spawn_seconds * 1e6, entry->status);
+    }
+}
+
+static int compare_wall_seconds(const void *a, const void *b) {
+    const ProfileEntry *x = *(ProfileEntry * const *)a;
+    const ProfileEntry *y = *(ProfileEntry * const *)b;
+    if (x->wall_seconds != y->wall_seconds) {
+        return x->wall_seconds < y->wall_seconds ? 1 : -1;
+    }
+    return x->line - y->line;
+}
+
+static void write_json_string(FILE *out, const char *text) {
+    fputc('"', out);
+    for (const char *p = text; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if ((unsigned char)*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// Runs at exit under --profile: a table of command lines, slowest first, on
+// stderr, or every line in order as JSON to the --profile file
+void report_profile() {
+    if (profile_file != NULL) {
+        FILE *out = fopen(profile_file, "w");
+        if (out == NULL) {
+            fprintf(stderr, "An error has occurred\n");
+            return;
+        }
+        fprintf(out, "{\"commands\": [");
+        for (int i = 0; i < profile_count; i++) {
+            ProfileEntry *entry = &profile_entries[i];
+            fprintf(out, "%s\n  {\"line\": %d, \"command\": ", i > 0 ? "," : "", entry->line);
+            write_json_string(out, entry->command);
+            fprintf(out, ", \"wall_seconds\": %.6f, \"user_seconds\": %.6f, \"sys_seconds\": %.6f, "
+                    "\"max_rss_kb\": %ld, \"spawn_seconds\": %.6f, \"status\": %d}",
+                    entry->wall_seconds, entry->user_seconds, entry->sys_seconds,
+                    entry->max_rss_kb, entry->spawn_seconds, entry->status);
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+        return;
+    }
+
+    ProfileEntry **sorted = malloc(sizeof(ProfileEntry *) * (profile_count + 1));
+    double total_wall = 0, total_user = 0, total_sys = 0;
+    for (int i = 0; i < profile_count; i++) {
+        sorted[i] = &profile_entries[i];
+        total_wall += profile_entries[i].wall_seconds;
+        total_user += profile_entries[i].user_seconds;
+        total_sys += profile_entries[i].sys_seconds;
+    }
+    qsort(sorted, profile_count, sizeof(ProfileEntry *), compare_wall_seconds);
+
+    fprintf(stderr, "wish profile: %d commands, %.3f s wall, %.3f s user, %.3f s sys\n",
+            profile_count, total_wall, total_user, total_sys);
+    fprintf(stderr, "%6s %10s %10s %10s %10s %10s %6s  %s\n",
+            "line", "wall_s", "user_s", "sys_s", "maxrss_kb", "spawn_us", "status", "command");
+    for (int i = 0; i < profile_count; i++) {
+        ProfileEntry *entry = sorted[i];
+        fprintf(stderr, "%6d %10.4f %10.4f %10.4f %10ld %10.0f %6d  %s\n",
+                entry->line, entry->wall_seconds, entry->user_seconds, entry->sys_seconds,
+                entry->max_rss_kb, entry->spawn_seconds * 1e6, entry->status, entry->command);
+    }
+    free(sorted);
+}
+
+// cat and wcat without a child process, for WISH_FAST_BUILTINS=1. Only
+// plain foreground runs are handled, and only when the command would be
+// found on the path anyway; anything with a flag returns -1 so that the
+// real program runs instead. wcat behaves like main.c: it stops at the first
+// file it cannot open.
+int run_fast_builtin(char *args[], int redirect, char *output_file) {
+    int is_wcat = (strcmp(args[0], "wcat") == 0);
+    if (!is_wcat && strcmp(args[0], "cat") != 0) {
+        return -1;
+    }
+    for (int i = 1; args[i] != NULL; i++) {
+        if (args[i][0] == '-' && args[i][1] != '\0') {
+            return -1;
+        }
+    }
+    char command[PATH_MAX];
+    if (resolve_command(args[0], command, sizeof(command)) == -1) {
+        return -1;
+    }
+
+    int profile = profile_enabled ? start_profile(&args, 1, 0) : -1;
+    int out_fd = STDOUT_FILENO;
+    if (redirect) {
+        out_fd = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, S_IRWXU);
+        if (out_fd == -1) {
+            fprintf(stderr, "An error has occurred\n");
+            global_last_command_status = 1;
+            finish_profile(profile, 1, monotonic_seconds());
+            return 0;
+        }
+    }
+    fflush(stdout);
+
+    // A reader that goes away must not kill the shell itself. The real
+    // program would die of SIGPIPE; here the copy just stops with status 1.
+    // The old action is put back afterwards, so spawned children still get
+    // SIGPIPE as before.
+    struct sigaction ignore, saved;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGPIPE, &ignore, &saved);
+
+    int status = 0;
+    if (!is_wcat && args[1] == NULL) {
+        status = fast_copy(STDIN_FILENO, out_fd) == 0 ? 0 : 1;
+    }
+    int broken_pipe = 0;
+    for (int i = 1; args[i] != NULL && !broken_pipe; i++) {
+        int in_fd = (!is_wcat && strcmp(args[i], "-") == 0) ? STDIN_FILENO : open(args[i], O_RDONLY);
+        if (in_fd == -1) {
+            status = 1;
+            if (is_wcat) {
+                write(out_fd, "Unable to open file\n", strlen("Unable to open file\n"));
+                break;
+            }
+            fprintf(stderr, "cat: %s: %s\n", args[i], strerror(errno));
+            continue;
+        }
+        if (fast_copy(in_fd, out_fd) == -1) {
+            broken_pipe = (errno == EPIPE);
+            if (!broken_pipe) {
+                fprintf(stderr, "%s: %s: %s\n", args[0], args[i], strerror(errno));
+            }
+            status = 1;
+        }
+        if (in_fd != STDIN_FILENO) {
+            close(in_fd);
+        }
+    }
+
+    sigaction(SIGPIPE, &saved, NULL);
+
+    if (out_fd != STDOUT_FILENO) {
+        close(out_fd);
+    }
+    global_last_command_status = status;
+    finish_profile(profile, status, monotonic_seconds());
+    return 0;
+}
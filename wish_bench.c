@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include "wish_lex.h"
+
+// Benchmark driver for wish.
+//
+// Writes a batch file of trivial commands and measures how many commands per
+// second wish gets through it, optionally next to a reference shell running
+// the same file. With -p it instead times wish's tokenizer alone over the
+// batch file, in lines parsed per second.
+//
+// Build: gcc -O2 wish_bench.c wish_lex.c -o wish_bench
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs "shell script" with output discarded; returns wall seconds or -1
+static double run_script(const char *shell, const char *script) {
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    } else if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd != -1) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+        execl(shell, shell, script, (char *) NULL);
+        perror(shell);
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) {
+        perror("waitpid");
+        exit(EXIT_FAILURE);
+    }
+    double elapsed = now_seconds() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return elapsed;
+}
+
+static void report(const char *shell, const char *script, int lines, int reps) {
+    double best = -1;
+    for (int rep = 0; rep < reps; rep++) {
+        double elapsed = run_script(shell, script);
+        if (elapsed < 0) {
+            fprintf(stderr, "%s failed on %s\n", shell, script);
+            exit(EXIT_FAILURE);
+        }
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    printf("%-20s %8d commands %10.3f s %12.0f spawns/s %8.1f us/command\n",
+           shell, lines, best, lines / best, best * 1e6 / lines);
+}
+
+// Reads and tokenizes every line of script the way wish does, without
+// running anything
+static void report_parse(const char *script, int lines, int reps) {
+    Lexer lexer = {0};
+    char *line = NULL;
+    size_t len = 0;
+    long tokens = 0;
+    double best = -1;
+
+    for (int rep = 0; rep < reps; rep++) {
+        FILE *fp = fopen(script, "r");
+        if (fp == NULL) {
+            perror(script);
+            exit(EXIT_FAILURE);
+        }
+        tokens = 0;
+        double start = now_seconds();
+        while (getline(&line, &len, fp) != -1) {
+            if (lex_line(&lexer, line) != 0) {
+                fprintf(stderr, "tokenizer rejected: %s", line);
+                exit(EXIT_FAILURE);
+            }
+            tokens += lexer.count;
+        }
+        double elapsed = now_seconds() - start;
+        fclose(fp);
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    printf("%-20s %8d lines %10.3f s %12.0f lines/s %8.1f tokens/line\n",
+           "lex_line", lines, best, lines / best, (double)tokens / lines);
+    free(line);
+    lexer_free(&lexer);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-w wish] [-n lines] [-c command] [-r reps] [-s shell] [-p]\n"
+            "  -w  path to the wish binary (default ./wish)\n"
+            "  -n  number of lines in the batch file (default 10000)\n"
+            "  -c  command written on every line (default true)\n"
+            "  -r  repetitions, best time is kept (default 3)\n"
+            "  -s  also run the batch file with this reference shell\n"
+            "  -p  only time parsing the batch file, nothing is run\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    const char *wish = "./wish";
+    const char *command = "true";
+    const char *reference = NULL;
+    int lines = 10000;
+    int reps = 3;
+    int parse_only = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:n:c:r:s:p")) != -1) {
+        switch (opt) {
+            case 'w': wish = optarg; break;
+            case 'n': lines = atoi(optarg); break;
+            case 'c': command = optarg; break;
+            case 'r': reps = atoi(optarg); break;
+            case 's': reference = optarg; break;
+            case 'p': parse_only = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (lines < 1 || reps < 1)
+        usage(argv[0]);
+
+    char script[] = "/tmp/wish_bench.XXXXXX";
+    int fd = mkstemp(script);
+    if (fd == -1) {
+        perror("mkstemp");
+        exit(EXIT_FAILURE);
+    }
+    FILE *fp = fdopen(fd, "w");
+    for (int i = 0; i < lines; i++)
+        fprintf(fp, "%s\n", command);
+    fclose(fp);
+
+    if (parse_only)
+        report_parse(script, lines, reps);
+    else
+        report(wish, script, lines, reps);
+    if (reference != NULL && !parse_only)
+        report(reference, script, lines, reps);
+
+    unlink(script);
+    return 0;
+}
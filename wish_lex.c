@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include "wish_lex.h"
+
+static void add_token(Lexer *lexer, TokenType type, char *text) {
+    if (lexer->count == lexer->capacity) {
+        lexer->capacity = lexer->capacity ? lexer->capacity * 2 : 32;
+        lexer->tokens = realloc(lexer->tokens, sizeof(Token) * lexer->capacity);
+    }
+    lexer->tokens[lexer->count].type = type;
+    lexer->tokens[lexer->count].text = text;
+    lexer->count++;
+}
+
+int lex_line(Lexer *lexer, char *line) {
+    char *r = line;     // Next character to read
+    char *w = line;     // Where the current word's next character goes
+    char *word = NULL;  // Start of the current word, if inside one
+
+    lexer->count = 0;
+    while (1) {
+        char c = *r;
+
+        if (c == '\'' || c == '"') {
+            if (word == NULL) {
+                word = w;
+            }
+            r++;
+            while (*r != c) {
+                if (*r == '\0') {
+                    return -1;
+                }
+                if (c == '"' && *r == '\\' && (r[1] == '"' || r[1] == '\\')) {
+                    r++;
+                }
+                *w++ = *r++;
+            }
+            r++;
+            continue;
+        }
+        if (c == '\\') {
+            // getline keeps the newline, so that counts as the end as well
+            if (r[1] == '\0' || (r[1] == '\n' && r[2] == '\0')) {
+                return -1;
+            }
+            if (word == NULL) {
+                word = w;
+            }
+            *w++ = r[1];
+            r += 2;
+            continue;
+        }
+        if (c != '\0' && c != ' ' && c != '\t' && c != '\n' && c != '\r' &&
+            c != '>' && c != '&' && c != '|') {
+            if (word == NULL) {
+                word = w;
+            }
+            *w++ = c;
+            r++;
+            continue;
+        }
+
+        // A delimiter ends the current word. The terminator may land on the
+        // delimiter itself, which is why c was read first.
+        if (word != NULL) {
+            *w++ = '\0';
+            add_token(lexer, TOKEN_WORD, word);
+            word = NULL;
+        }
+        if (c == '\0') {
+            break;
+        }
+        if (c == '>') {
+            add_token(lexer, TOKEN_REDIRECT, NULL);
+        } else if (c == '&') {
+            add_token(lexer, TOKEN_BACKGROUND, NULL);
+        } else if (c == '|') {
+            add_token(lexer, TOKEN_PIPE, NULL);
+        }
+        r++;
+        w = r;
+    }
+
+    // Every token could become an argv slot, plus the final NULL
+    if (lexer->argv_capacity < lexer->count + 1) {
+        lexer->argv_capacity = lexer->capacity + 1;
+        lexer->argv = realloc(lexer->argv, sizeof(char *) * lexer->argv_capacity);
+    }
+    return 0;
+}
+
+void lexer_free(Lexer *lexer) {
+    free(lexer->tokens);
+    free(lexer->argv);
+    lexer->tokens = NULL;
+    lexer->argv = NULL;
+    lexer->count = lexer->capacity = lexer->argv_capacity = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef _WISH_LEX_H
+#define _WISH_LEX_H
+
+// Single-pass tokenizer for wish command lines.
+//
+// Words are unquoted and unescaped in place, so every word points into the
+// line itself and nothing is copied. The token and argv arrays belong to the
+// lexer and are reused for the next line, growing only when a line needs
+// more room than any before it.
+
+typedef enum {
+    TOKEN_WORD,
+    TOKEN_REDIRECT,    // >
+    TOKEN_BACKGROUND,  // &
+    TOKEN_PIPE         // |
+} TokenType;
+
+typedef struct {
+    TokenType type;
+    char *text;        // NUL-terminated word; NULL for operators
+} Token;
+
+typedef struct {
+    Token *tokens;
+    int count;
+    int capacity;
+    char **argv;       // Room for every word plus a NULL after each stage
+    int argv_capacity;
+} Lexer;
+
+// Splits line into tokens, modifying it in place. ' quotes everything up to
+// the next ', " quotes everything but \" and \\, and outside quotes a
+// backslash takes the next character literally. Returns -1 on an unterminated
+// quote or a backslash at the end of the line (before any newline), 0
+// otherwise.
+int lex_line(Lexer *lexer, char *line);
+void lexer_free(Lexer *lexer);
+
+#endif